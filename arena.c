@@ -0,0 +1,76 @@
+/*
+ *	Arenas for hosted builds. Memory comes from the heap a chunk at a
+ *	time and is handed out by bumping a pointer. Nothing is given back
+ *	singly, instead the whole arena is reset once its owner is done with
+ *	everything in it, and the chunks are kept for reuse.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "compiler.h"
+
+#ifdef ARENA
+
+struct chunk {
+    struct chunk *next;
+    unsigned size;
+    union {			/* Aligned for anything we keep */
+        unsigned long l;
+        void *p;
+    } data[1];
+};
+
+#define ALIGN	sizeof(((struct chunk *)0)->data[0])
+
+static void new_chunk(struct arena *a, unsigned size)
+{
+    struct chunk **cp = &a->spare;
+    struct chunk *c;
+
+    while((c = *cp) != NULL) {
+        if (c->size >= size) {
+            *cp = c->next;
+            break;
+        }
+        cp = &c->next;
+    }
+    if (c == NULL) {
+        if (size < a->chunksize)
+            size = a->chunksize;
+        c = malloc(sizeof(struct chunk) + size);
+        if (c == NULL)
+            fatal("out of memory");
+        c->size = size;
+    }
+    c->next = a->used;
+    a->used = c;
+    a->ptr = (char *)c->data;
+    a->end = a->ptr + c->size;
+}
+
+void *arena_alloc(struct arena *a, unsigned size)
+{
+    char *p;
+
+    size = (size + ALIGN - 1) & ~(ALIGN - 1);
+    if ((unsigned)(a->end - a->ptr) < size)
+        new_chunk(a, size);
+    p = a->ptr;
+    a->ptr += size;
+    return p;
+}
+
+void arena_reset(struct arena *a)
+{
+    struct chunk *c;
+
+    while((c = a->used) != NULL) {
+        a->used = c->next;
+        c->next = a->spare;
+        a->spare = c;
+    }
+    a->ptr = a->end = NULL;
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifdef ARENA
+
+struct chunk;
+
+struct arena {
+    struct chunk *used;		/* Chunks in use, newest first */
+    struct chunk *spare;	/* Chunks kept back by a reset */
+    char *ptr;
+    char *end;
+    unsigned chunksize;
+};
+
+extern void *arena_alloc(struct arena *a, unsigned size);
+extern void arena_reset(struct arena *a);
+
+#endif
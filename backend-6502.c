@@ -43,7 +43,6 @@
 static unsigned frame_len;	/* Number of bytes of stack frame */
 static unsigned sp;		/* Stack pointer offset tracking */
 static unsigned unreachable;	/* Code following an unconditional jump */
-static unsigned xlabel;		/* Internal backend generated branches */
 static unsigned argbase;	/* Track shift between arguments and stack */
 
 /*
@@ -93,7 +93,6 @@ static unsigned frame_len;	/* Number of bytes of stack frame */
 static unsigned arg_len;	/* Number of bytes of argument frame */
 static unsigned sp;		/* Stack pointer offset tracking */
 static unsigned unreachable;	/* Code following an unconditional jump */
-static unsigned xlabel;		/* Internal backend generated branches */
 static unsigned argbase;	/* Track shift between arguments and stack */
 static unsigned livesize = 2;	/* 16bit mode generating for */
 static unsigned cursize = 2;	/* 16bit mode currently set */
@@ -203,6 +203,8 @@ void gen_value(unsigned type, unsigned long value)
 
 void gen_start(void)
 {
+	/* The divide is a single operation for us so leave it be */
+	fast_divide = 1;
 	printf("\t.code\n");
 }
 
@@ -302,6 +302,8 @@ void gen_value(unsigned type, unsigned long value)
 
 void gen_start(void)
 {
+	/* The divide is a single operation for us so leave it be */
+	fast_divide = 1;
 	if (cpu == 1802) {
 		frame_off = 4;	/* Two words - old FP and old BPC */
 		has_fp = 1;	/* Offsets are FP relative */
@@ -49,7 +49,6 @@ static unsigned frame_len;	/* Number of bytes of stack frame */
 static unsigned sp;		/* Stack pointer offset tracking */
 static unsigned argbase;	/* Argument offset in current function */
 static unsigned unreachable;	/* Code following an unconditional jump */
-static unsigned label_count;	/* Used for internal labels X%u: */
 
 static unsigned r14_sp;		/* R14/15 address relative to SP */
 static unsigned r14_valid;	/* R14/15 are a valid local ptr */
@@ -666,9 +665,9 @@ static void cmpne_r_0(unsigned r, unsigned size)
 		printf("\tor r3, r%u\n", r++);
 	r_modify(3, 1);
 	load_r_constb(2,0);
-	printf("\tjr z, X%u\n", ++label_count);
+	printf("\tjr z, X%u\n", ++xlabel);
 	load_r_constb(3, 1);
-	printf("X%u:\n", label_count);
+	printf("X%u:\n", xlabel);
 }
 
 static void cmpeq_r_0(unsigned r, unsigned size)
@@ -702,8 +701,8 @@ static unsigned label(void)
 {
 	invalidate_all();
 	unreachable = 0;
-	printf("X%u:\n", ++label_count);
-	return label_count;
+	printf("X%u:\n", ++xlabel);
+	return xlabel;
 }
 
 
@@ -2972,7 +2971,7 @@ unsigned gen_shortcut(struct node *n)
 			}
 			codegen_lr(r);
 			/* Do r << ac */
-			v = ++label_count;
+			v = ++xlabel;
 			/* Only works on AC for now */
 			opnoeff_r_r(3, 3, "or");
 			printf("\tjr z, X%u\n", v);
@@ -2989,7 +2988,7 @@ unsigned gen_shortcut(struct node *n)
 				return 1;
 			}
 			codegen_lr(r);
-			v = ++label_count;
+			v = ++xlabel;
 			/* Only works on AC */
 			opnoeff_r_r(3, 3, "or");
 			printf("\tjr z, X%u\n", v);
@@ -3386,7 +3385,7 @@ unsigned gen_node(struct node *n)
 		load_r_r(R_WORK, 3);
 		pop_ac(size);	/* Recover working reg off stack */
 		printf("\tor r%u,r%u\n", R_WORK, R_WORK);
-		v = ++label_count;
+		v = ++xlabel;
 		printf("\tjr z, X%u\n", v);
 		x = label();
 		add_r_r(R_AC, R_AC, size);
@@ -3400,7 +3399,7 @@ unsigned gen_node(struct node *n)
 		load_r_r(R_WORK, 3);
 		pop_ac(size);	/* Recover working reg off stack */
 		printf("\tor r%u,r%u\n", R_WORK, R_WORK);
-		v = ++label_count;
+		v = ++xlabel;
 		printf("jr z, X%u\n", v);
 		x = label();
 		rshift_r(R_AC, size, 1, n->type & UNSIGNED);
@@ -3486,7 +3485,7 @@ unsigned gen_node(struct node *n)
 		T_STAR, T_SLASH, T_PERCENT, T_STARTEQ, T_SLASHEQ, T_PERCENTEQ */
 	case T_SHLEQ:
 		/* Pointer into r14/r15 */
-		v = ++label_count;
+		v = ++xlabel;
 		pop_rr(R_INDEX);
 		/* Save counter */
 		load_r_r(R_WORK, R_ACCHAR);
@@ -3502,7 +3501,7 @@ unsigned gen_node(struct node *n)
 		return 1;
 	case T_SHREQ:
 		/* Pointer into r14/r15 */
-		v = ++label_count;
+		v = ++xlabel;
 		pop_rr(R_INDEX);
 		load_r_r(R_WORK, R_ACCHAR);
 		printf("\tor r%u,r%u\n", R_WORK, R_WORK);
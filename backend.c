@@ -8,10 +8,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <ctype.h>
+#include <dirent.h>
 
 #include "symtab.h"
 #include "compiler.h"
@@ -23,6 +25,7 @@ unsigned cpu;
 unsigned opt;
 unsigned optsize;
 const char *codeseg = "code";
+unsigned xlabel;		/* Internal labels used by some targets */
 
 static unsigned process_one_block(uint8_t * h);
 
@@ -34,9 +37,110 @@ void error(const char *p)
 	exit(1);
 }
 
+/* When caching functions we read each one ahead to see if we know it. If
+   not we feed it back through here from the copy we kept */
+static uint8_t *replay;
+static unsigned replay_len;
+static unsigned replay_pos;
+
+/*
+ *	Our input is read a large block at a time and everything that reads
+ *	it goes through in_need() and in_skip(). in_need() hands back a
+ *	pointer to the next len bytes without using them up, so a caller can
+ *	look ahead and decode in place. While replaying a cached function the
+ *	bytes come from the replay copy instead.
+ */
+#define IN_BLOCK	65536
+
+static uint8_t inbuf[IN_BLOCK];
+static unsigned in_pos;
+static unsigned in_len;
+
+static uint8_t *in_need(unsigned len)
+{
+	int n;
+
+	if (replay) {
+		if (replay_pos + len > replay_len)
+			error("short read");
+		return replay + replay_pos;
+	}
+	if (in_len - in_pos < len) {
+		if (len > IN_BLOCK)
+			error("block too large");
+		memmove(inbuf, inbuf + in_pos, in_len - in_pos);
+		in_len -= in_pos;
+		in_pos = 0;
+		/* Our input may be a pipe so we may get it in pieces */
+		while (in_len < len) {
+			n = read(0, inbuf + in_len, IN_BLOCK - in_len);
+			if (n <= 0)
+				error("short read");
+			in_len += n;
+		}
+	}
+	return inbuf + in_pos;
+}
+
+static void in_skip(unsigned len)
+{
+	if (replay) {
+		replay_pos += len;
+		if (replay_pos == replay_len)
+			replay = NULL;
+	} else
+		in_pos += len;
+}
+
+/* Is there any more input. Returns 0 for a clean end of file */
+static unsigned in_more(void)
+{
+	int n;
+
+	if (replay || in_pos < in_len)
+		return 1;
+	n = read(0, inbuf, IN_BLOCK);
+	if (n < 0)
+		error("read error");
+	in_pos = 0;
+	in_len = n;
+	return n != 0;
+}
+
+static unsigned in_byte(void)
+{
+	unsigned c = *in_need(1);
+	in_skip(1);
+	return c;
+}
+
+/* Read a block. Returns 0 for a clean end of file */
+static int xread_eof(int fd, void *buf, int len)
+{
+	unsigned char *p = buf;
+	int n;
+	if (fd == 0) {
+		if (!in_more())
+			return 0;
+		memcpy(buf, in_need(len), len);
+		in_skip(len);
+		return 1;
+	}
+	while (len) {
+		n = read(fd, p, len);
+		if (n == 0 && p == buf)
+			return 0;
+		if (n <= 0)
+			error("short read");
+		p += n;
+		len -= n;
+	}
+	return 1;
+}
+
 static void xread(int fd, void *buf, int len)
 {
-	if (read(fd, buf, len) != len)
+	if (xread_eof(fd, buf, len) == 0)
 		error("short read");
 }
 
@@ -45,13 +149,82 @@ static void xread(int fd, void *buf, int len)
  *
  *	We can just cache bits of this in cc2 if we actually get tight on
  *	space. It's not a big deal as we only use names for global and static
- *	objects.
+ *	objects. On a hosted system we keep the lot instead.
  */
 
+static unsigned max_name;
+static const char *sym_path;
+
+static void load_symbols(void);
+
+#ifdef ARENA
+
+/* Name n lives in record n & 0x7FFF. Records are read in blocks that
+   never move so the pointers we hand out stay good */
+static char **namep;
+static unsigned nnames;
+
+/* Read whatever records we don't yet have. We go to the end of the file
+   rather than trust the count at the front, as in a pipeline the front
+   end fills that in last and may still be adding names */
+static void read_names(void)
+{
+	struct name *block;
+	unsigned size = 256;
+	unsigned len = 0;
+	unsigned i;
+	int n;
+
+	if (lseek(sym_fd, 2 + sizeof(struct name) * nnames, 0) < 0)
+		error("seeksym");
+	block = malloc(size * sizeof(struct name));
+	while (block) {
+		if (len == size * sizeof(struct name)) {
+			size *= 2;
+			block = realloc(block, size * sizeof(struct name));
+			if (block == NULL)
+				break;
+		}
+		n = read(sym_fd, (char *)block + len, size * sizeof(struct name) - len);
+		if (n < 0)
+			error("readsym");
+		if (n == 0)
+			break;
+		len += n;
+	}
+	if (block == NULL)
+		error("out of memory");
+	/* Leave any part record for next time */
+	len /= sizeof(struct name);
+	if (len == 0) {
+		free(block);
+		return;
+	}
+	namep = realloc(namep, (nnames + len) * sizeof(char *));
+	if (namep == NULL)
+		error("out of memory");
+	for (i = 0; i < len; i++)
+		namep[nnames++] = block[i].name;
+}
+
+char *namestr(unsigned n)
+{
+	n &= 0x7FFF;
+	if (n >= nnames) {
+		if (sym_fd == -1)
+			load_symbols();
+		read_names();
+		if (n >= nnames)
+			error("name");
+	}
+	return namep[n];
+}
+
+#else
+
 #define NCACHE_SIZE	32
 static struct name names[NCACHE_SIZE];
 static struct name *nhead;
-static unsigned max_name;
 
 char *namestr(unsigned n)
 {
@@ -70,6 +243,8 @@ char *namestr(unsigned n)
 		np = np->next;
 	}
 	/* Hack for now we need to pick a better node */
+	if (sym_fd == -1)
+		load_symbols();
 	if (lseek(sym_fd, 2 + sizeof(struct name) * (n & 0x7FFF), 0) < 0)
 		error("seeksym");
 	xread(sym_fd, prev, sizeof(struct name));
@@ -89,19 +264,42 @@ static void init_name_cache(void)
 	nhead = names;
 }
 
+#endif
+
 /*
- *	Expression tree nodes
+ *	Expression tree nodes. We keep each tree only while generating it so
+ *	a fixed table sized as cc1 sizes its node pool will do on a small box.
+ *	A hosted cc1 has no limit on the size of a tree, so there we add
+ *	another NUM_NODES to the free list whenever it runs dry.
  */
-#define NUM_NODES 100
 
+#ifndef ARENA
 static struct node node_table[NUM_NODES];
+#endif
 static struct node *nodes;
 
+#ifdef ARENA
+static void more_nodes(void)
+{
+	struct node *n = malloc(NUM_NODES * sizeof(struct node));
+	unsigned i;
+
+	if (n == NULL)
+		error("out of memory");
+	for (i = 0; i < NUM_NODES; i++)
+		free_node(n++);
+}
+#endif
+
 struct node *new_node(void)
 {
 	struct node *n;
 	if (nodes == NULL)
+#ifdef ARENA
+		more_nodes();
+#else
 		error("Too many nodes");
+#endif
 	n = nodes;
 	nodes = n->right;
 	n->left = n->right = NULL;
@@ -118,10 +316,14 @@ void free_node(struct node *n)
 
 void init_nodes(void)
 {
+#ifdef ARENA
+	more_nodes();
+#else
 	int i;
 	struct node *n = node_table;
 	for (i = 0; i < NUM_NODES; i++)
 		free_node(n++);
+#endif
 }
 
 void free_tree(struct node *n)
@@ -162,26 +364,186 @@ static void pop_area(void)
 	}
 }
 
-/* I/O buffering stuff can wait - as can switching to a block write method */
 static struct node *load_tree(void)
 {
 	struct node *n = new_node();
-	xread(0, n, sizeof(struct node));
+	unsigned len = *in_need(1) + 1;
+	unsigned shape;
 
-	/* The values off disk are old pointers or NULL, that's good enough
-	   to use as a load flag */
-	if (n->left)
+	shape = unpack_node(n, in_need(len) + 1);
+	in_skip(len);
+	if (shape & N_LEFT)
 		n->left = load_tree();
-	if (n->right)
+	if (shape & N_RIGHT)
 		n->right = load_tree();
 	return n;
 }
 
+/*
+ *	Division by a constant. Most of our targets divide with a slow
+ *	helper, so when the dividend is narrow enough we turn x / d into
+ *	(x * m) >> p in a type that holds the product (Granlund and
+ *	Montgomery). Targets with a divide as quick as their multiply set
+ *	fast_divide to keep their divides.
+ */
+
+static struct node *div_node(unsigned op, unsigned type, struct node *l,
+				struct node *r, unsigned long value)
+{
+	struct node *n = new_node();
+	n->op = op;
+	n->type = type;
+	n->left = l;
+	n->right = r;
+	n->value = value;
+	n->snum = 0;
+	n->val2 = 0;
+	return n;
+}
+
+static struct node *copy_tree(struct node *n)
+{
+	struct node *c = new_node();
+	*c = *n;
+	if (n->left)
+		c->left = copy_tree(n->left);
+	if (n->right)
+		c->right = copy_tree(n->right);
+	return c;
+}
+
+/* Locals, arguments and register variables are the only objects we can
+   be sure are not volatile, so the only ones we may read twice */
+static unsigned local_tree(struct node *n)
+{
+	return n->op == T_LOCAL || n->op == T_ARGUMENT || n->op == T_REG;
+}
+
+/* A value we can work out twice and get the same answer */
+static unsigned simple_tree(struct node *n)
+{
+	if (n->op == T_CAST)
+		n = n->right;
+	if (n->op == T_CONSTANT)
+		return 1;
+	return n->op == T_DEREF && local_tree(n->right);
+}
+
+static unsigned type_bits(unsigned t)
+{
+	if (t >= CLONG)
+		return 32;
+	if (t >= CSHORT)
+		return 16;
+	return 8;
+}
+
+/* Returns NULL if we leave it alone, otherwise consumes l and r */
+static struct node *div_by_mul(unsigned op, unsigned t, struct node *l, struct node *r)
+{
+	struct node *x = l;
+	struct node *c = NULL;
+	struct node *q;
+	unsigned long d, m, top;
+	unsigned bits, p;
+	unsigned mt;
+
+	if (r->op != T_CONSTANT || PTR(t) || t >= CLONGLONG)
+		return NULL;
+	bits = type_bits(t);
+	d = r->value;
+	if (bits < 32)
+		d &= (1UL << bits) - 1;
+	/* A widened unsigned value has a smaller range even if t is signed */
+	if (l->op == T_CAST && !(l->right->flags & LVAL) &&
+	    IS_INTARITH(l->right->type) && (l->right->type & UNSIGNED) &&
+	    type_bits(l->right->type) < bits) {
+		x = l->right;
+		bits = type_bits(x->type);
+	} else if (!(t & UNSIGNED))
+		return NULL;
+	/* The backends already handle powers of two */
+	if (bits == 32 || d < 3 || !(d & (d - 1)) || (d >> bits))
+		return NULL;
+	if (op == T_PERCENT && !simple_tree(l))
+		return NULL;
+
+	/* Find the smallest p with 2^p <= m * d <= 2^p + 2^(p - bits) */
+	for (p = bits; p < 32; p++) {
+		m = ((1UL << p) + d - 1) / d;
+		if (m * d - (1UL << p) <= (1UL << (p - bits)))
+			break;
+	}
+	if (p == 32)
+		return NULL;
+	top = (1UL << bits) - 1;
+	if (p < 16 && m <= 0xFFFFUL / top)
+		mt = UINT;
+	else if (m <= 0xFFFFFFFFUL / top)
+		mt = ULONG;
+	else
+		return NULL;
+	/* A 16bit multiply beats any helper divide, a 32bit one only a long
+	   divide */
+	if (fast_divide || optsize || opt == 0 || (mt != UINT && t < CLONG))
+		return NULL;
+
+	if (op == T_PERCENT)
+		c = copy_tree(l);
+	if (x != l)
+		free_node(l);
+	if (x->type != mt)
+		x = div_node(T_CAST, mt, NULL, x, 0);
+	q = div_node(T_STAR, mt, x, div_node(T_CONSTANT, mt, NULL, NULL, m), 0);
+	q = div_node(T_GTGT, mt, q, div_node(T_CONSTANT, CINT, NULL, NULL, p), 0);
+	if (mt != t)
+		q = div_node(T_CAST, t, NULL, q, 0);
+	if (op == T_SLASH) {
+		free_node(r);
+		return q;
+	}
+	/* x % d is x - (x / d) * d */
+	r->value = d;
+	return div_node(T_MINUS, t, c, div_node(T_STAR, t, q, r, 0), 0);
+}
+
+static struct node *rewrite_div(struct node *n)
+{
+	struct node *l = n->left;
+	struct node *q;
+
+	if (n->op == T_SLASH || n->op == T_PERCENT) {
+		q = div_by_mul(n->op, n->type, l, n->right);
+		if (q)
+			free_node(n);
+		return q ? q : n;
+	}
+	/* x /= d is x = x / d if we can read and write x separately */
+	if (!local_tree(l) || n->right->op != T_CONSTANT)
+		return n;
+	l = div_node(T_DEREF, n->type, NULL, copy_tree(l), 0);
+	q = div_by_mul(n->op == T_SLASHEQ ? T_SLASH : T_PERCENT, n->type, l, n->right);
+	if (q == NULL) {
+		free_tree(l);
+		return n;
+	}
+	n->op = T_EQ;
+	n->right = q;
+	return n;
+}
+
 static unsigned depth = 0;
 
 static struct node *rewrite_tree(struct node *n)
 {
 	unsigned f = 0;
+	switch (n->op) {
+	case T_SLASH:
+	case T_PERCENT:
+	case T_SLASHEQ:
+	case T_PERCENTEQ:
+		n = rewrite_div(n);
+	}
 	depth++;
 /*	printf("; %-*s %04x (%ld)\n", depth, "", n->op, n->value); */
 	if (n->left) {
@@ -386,24 +748,62 @@ static unsigned compile_expression(void)
  *	handle the needs of the platform.
  */
 
+static unsigned codegen_label;
+
 static unsigned func_ret;
 static unsigned frame_len;
 static unsigned argframe_len;
 static unsigned func_ret_used;
 unsigned func_flags;
+unsigned fast_divide;		/* Set by a target that divides as quickly as it multiplies */
 
-static void process_literal(unsigned id)
+/* Dead functions for -fwhole-program (cc2 -d file) */
+static char **dead;
+static unsigned num_dead;
+
+static unsigned is_dead(const char *name)
+{
+	unsigned i;
+	for (i = 0; i < num_dead; i++)
+		if (strcmp(dead[i], name) == 0)
+			return 1;
+	return 0;
+}
+
+static void load_dead(const char *path)
+{
+	static char buf[128];
+	FILE *f = fopen(path, "r");
+	char *p;
+
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(buf, sizeof(buf), f)) {
+		p = strchr(buf, '\n');
+		if (p)
+			*p = 0;
+		dead = realloc(dead, (num_dead + 1) * sizeof(char *));
+		if (dead == NULL || (p = strdup(buf)) == NULL)
+			error("out of memory");
+		dead[num_dead++] = p;
+	}
+	fclose(f);
+}
+
+static void process_literal(unsigned id, unsigned emit)
 {
 	unsigned char c;
 	unsigned char shifted = 0;
 
-	gen_literal(id);
+	if (emit)
+		gen_literal(id);
 
 	/* A series of bytes terminated by a 0 marker. Internal
 	   zero is quoted, undo the quoting and turn it into data */
 	while (1) {
-		if (read(0, &c, 1) != 1)
-			error("unexpected EOF");
+		c = in_byte();
 		if (c == 0) {
 			break;
 		}
@@ -414,10 +814,280 @@ static void process_literal(unsigned id)
 		if (shifted && c == 254)
 			c = 0;
 		shifted = 0;
-		gen_value(UCHAR, c);
+		if (emit)
+			gen_value(UCHAR, c);
+	}
+}
+
+/* Throw away the rest of a function we don't need */
+static void skip_function(void)
+{
+	uint8_t b[2];
+	struct header h;
+
+	while (1) {
+		xread(0, b, 2);
+		if (b[0] != '%')
+			error("sync");
+		if (b[1] == '^' || b[1] == '[')
+			free_tree(load_tree());
+		else if (b[1] == 'H') {
+			xread(0, &h, sizeof(struct header));
+			if (h.h_type == H_STRING)
+				process_literal(h.h_name, 0);
+			if (h.h_type == (H_FUNCTION | H_FOOTER))
+				return;
+		} else
+			error("unknown block");
+	}
+}
+
+/*
+ *	Function cache (-c dir or -C dir, with -k salt). We read each function
+ *	ahead and hash it along with the names it uses and the state we start
+ *	it in. If the cache has the code for that we use it and skip the
+ *	function. With -c we keep the cache ourselves, with -C our output goes
+ *	through copt first so we just mark the functions for it to optimize
+ *	and store, or fetch from the cache.
+ */
+
+static const char *fc_dir;
+static unsigned fc_copt;
+static const char *fc_salt = "";
+static uint32_t fc_a, fc_b;
+static uint8_t *fc_buf;
+static unsigned fc_len;
+static unsigned fc_size;
+static char fc_key[17];
+static unsigned fc_active;
+static off_t fc_start;
+static char **fc_used;
+static unsigned fc_nused;
+
+static void fc_hash(const void *p, unsigned len)
+{
+	const uint8_t *d = p;
+	while (len--) {
+		fc_a = (fc_a ^ *d) * 16777619UL;
+		fc_b = *d++ + (fc_b << 6) + (fc_b << 16) - fc_b;
+	}
+}
+
+static void fc_word(unsigned long v)
+{
+	uint8_t b[4];
+	b[0] = v;
+	b[1] = v >> 8;
+	b[2] = v >> 16;
+	b[3] = v >> 24;
+	fc_hash(b, 4);
+}
+
+/* Hash names by what they are not by their number, so that new names
+   elsewhere in the file don't change the key */
+static void fc_name(unsigned n)
+{
+	char *p = namestr(n);
+	fc_hash(p, strlen(p) + 1);
+}
+
+/* Read more of the function and keep a copy to replay */
+static void fc_read(void *p, unsigned len)
+{
+	if (fc_len + len > fc_size) {
+		fc_size = 2 * fc_size + len + 1024;
+		fc_buf = realloc(fc_buf, fc_size);
+		if (fc_buf == NULL)
+			error("out of memory");
+	}
+	xread(0, fc_buf + fc_len, len);
+	memcpy(p, fc_buf + fc_len, len);
+	fc_len += len;
+}
+
+static void fc_tree(void)
+{
+	struct node n;
+	uint8_t b[NODE_MAX];
+	unsigned shape;
+
+	fc_read(b, 1);
+	fc_read(b + 1, b[0]);
+	shape = unpack_node(&n, b + 1);
+	fc_word(n.op);
+	fc_word(n.type);
+	fc_word(n.flags);
+	fc_word(n.value);
+	fc_word(n.val2);
+	if (n.op == T_NAME)
+		fc_name(n.snum);
+	else
+		fc_word(n.snum);
+	fc_word(shape);
+	if (shape & N_LEFT)
+		fc_tree();
+	if (shape & N_RIGHT)
+		fc_tree();
+}
+
+/* Read the rest of the function up to and including the footer */
+static void fc_capture(void)
+{
+	uint8_t b[2];
+	struct header h;
+	uint8_t c;
+
+	while (1) {
+		fc_read(b, 2);
+		if (b[0] != '%')
+			error("sync");
+		fc_hash(b, 2);
+		if (b[1] == '^' || b[1] == '[') {
+			fc_tree();
+			continue;
+		}
+		if (b[1] != 'H')
+			error("unknown block");
+		fc_read(&h, sizeof(struct header));
+		fc_word(h.h_type);
+		fc_word(h.h_name);
+		if (h.h_type == (H_FUNCTION | H_FOOTER)) {
+			fc_name(h.h_data);
+			return;
+		}
+		fc_word(h.h_data);
+		if (h.h_type == H_STRING) {
+			do {
+				fc_read(&c, 1);
+				fc_hash(&c, 1);
+			} while (c);
+		}
 	}
 }
 
+static char *fc_path(const char *name)
+{
+	static char buf[512];
+	if (strlen(fc_dir) + strlen(name) + 2 > sizeof(buf))
+		error("cache path too long");
+	sprintf(buf, "%s/%s", fc_dir, name);
+	return buf;
+}
+
+static void fc_use(void)
+{
+	fc_used = realloc(fc_used, (fc_nused + 1) * sizeof(char *));
+	if (fc_used == NULL || (fc_used[fc_nused] = strdup(fc_key)) == NULL)
+		error("out of memory");
+	fc_nused++;
+}
+
+/* Look the function up. Returns 1 if it came from the cache, otherwise
+   sets things up for it to be generated and saved */
+static unsigned fc_function(struct header *h)
+{
+	static char buf[512];
+	FILE *f;
+	unsigned l, x, s;
+	size_t n;
+
+	fc_a = 2166136261UL;
+	fc_b = 0;
+	fc_hash(fc_salt, strlen(fc_salt) + 1);
+	fc_word(codegen_label);
+	fc_word(xlabel);
+	fc_word(last_seg);
+	fc_word(argframe_len);
+	fc_word(h->h_name);
+	fc_name(h->h_data);
+	fc_len = 0;
+	fc_capture();
+	sprintf(fc_key, "%08lx%08lx", (unsigned long)fc_a, (unsigned long)fc_b);
+	fc_use();
+
+	f = fopen(fc_path(fc_key), "r");
+	if (f) {
+		if (fgets(buf, sizeof(buf), f) &&
+		    sscanf(buf, "%u %u %u", &l, &x, &s) == 3) {
+			codegen_label = l;
+			xlabel = x;
+			last_seg = s;
+			if (fc_copt)
+				printf(";%%%%H %s\n", fc_key);
+			else
+				while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+					fwrite(buf, 1, n, stdout);
+			fclose(f);
+			return 1;
+		}
+		fclose(f);
+	}
+	replay = fc_buf;
+	replay_len = fc_len;
+	replay_pos = 0;
+	fc_active = 1;
+	if (fc_copt)
+		printf(";%%%%F %s\n", fc_key);
+	else {
+		fflush(stdout);
+		fc_start = lseek(1, 0, SEEK_CUR);
+	}
+	return 0;
+}
+
+/* The function we were generating is finished */
+static void fc_end(void)
+{
+	char *tmp, *text;
+	off_t len;
+	FILE *f;
+
+	fc_active = 0;
+	if (fc_copt) {
+		printf(";%%%%E %u %u %u\n", codegen_label, xlabel, last_seg);
+		return;
+	}
+	fflush(stdout);
+	len = lseek(1, 0, SEEK_CUR) - fc_start;
+	text = malloc(len + 1);
+	tmp = strdup(fc_path("tmpXXXXXX"));
+	if (text == NULL || tmp == NULL)
+		error("out of memory");
+	/* We may not be able to read our output back, in which case we just
+	   don't save anything */
+	if (pread(1, text, len, fc_start) == len && (f = fdopen(mkstemp(tmp), "w")) != NULL) {
+		fprintf(f, "%u %u %u\n", codegen_label, xlabel, last_seg);
+		fwrite(text, 1, len, f);
+		if (fclose(f) == 0)
+			rename(tmp, fc_path(fc_key));
+		else
+			unlink(tmp);
+	}
+	free(text);
+	free(tmp);
+}
+
+/* Throw out anything we didn't use this time */
+static void fc_prune(void)
+{
+	DIR *d = opendir(fc_dir);
+	struct dirent *de;
+	unsigned i;
+
+	if (d == NULL)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		if (strlen(de->d_name) != 16)
+			continue;
+		for (i = 0; i < fc_nused; i++)
+			if (strcmp(fc_used[i], de->d_name) == 0)
+				break;
+		if (i == fc_nused)
+			unlink(fc_path(de->d_name));
+	}
+	closedir(d);
+}
+
 static void process_header(void)
 {
 	struct header h;
@@ -427,9 +1097,16 @@ static void process_header(void)
 
 	switch (h.h_type) {
 	case H_EXPORT:
-		gen_export(namestr(h.h_name));
+		if (!num_dead || !is_dead(namestr(h.h_name)))
+			gen_export(namestr(h.h_name));
 		break;
 	case H_FUNCTION:
+		if (num_dead && is_dead(namestr(h.h_data))) {
+			skip_function();
+			break;
+		}
+		if (fc_dir && fc_function(&h))
+			break;
 		push_area(A_CODE);
 		gen_prologue(namestr(h.h_data));
 		func_ret = h.h_name;
@@ -448,6 +1125,8 @@ static void process_header(void)
 			gen_label("_r", h.h_name);
 		gen_epilogue(frame_len, argframe_len);
 		pop_area();
+		if (fc_active)
+			fc_end();
 		break;
 	case H_FOR:
 		compile_expression();
@@ -598,7 +1277,7 @@ static void process_header(void)
 			push_area(A_LITERAL);
 		else
 			push_area(A_DATA);
-		process_literal(h.h_name);
+		process_literal(h.h_name, 1);
 		break;
 	case H_STRING | H_FOOTER:
 		pop_area();
@@ -905,15 +1584,18 @@ void make_node(struct node *n)
 }
 
 /*
- *	Load the symbol table from the front end
+ *	Load the symbol table from the front end. We don't do this until a
+ *	name is first needed. If we are running on the end of a pipe then
+ *	the front end is still writing it, but the names we need will always
+ *	be there before we see them used.
  */
 
-static void load_symbols(const char *path)
+static void load_symbols(void)
 {
 	uint8_t n[2];
-	sym_fd = open(path, O_RDONLY);
+	sym_fd = open(sym_path, O_RDONLY);
 	if (sym_fd == -1) {
-		perror(path);
+		perror(sym_path);
 		exit(1);
 	}
 	xread(sym_fd, n, 2);
@@ -942,8 +1624,6 @@ static unsigned process_one_block(uint8_t *h)
  *	Helpers for the targets
  */
 
-static unsigned codegen_label;
-
 /*
  *	Some 'expressions' are actually flow changing things disguised
  *	as expressions. Deal with them above the processor specific level.
@@ -1041,6 +1721,59 @@ void codegen_lr(struct node *n)
 	make_node(n);
 }
 
+/*
+ *	For -fwhole-program (cc2 -r) we generate no code but list the
+ *	functions and what each refers to. F and S start an exported or a
+ *	static function, E ends it and R names something referred to. An R
+ *	outside a function comes from data.
+ */
+
+static unsigned scan_export;
+
+static void scan_tree(struct node *n)
+{
+	if (n->op == T_NAME)
+		printf("R %s\n", namestr(n->snum));
+	if (n->left)
+		scan_tree(n->left);
+	if (n->right)
+		scan_tree(n->right);
+}
+
+static void scan_block(uint8_t *b)
+{
+	struct header h;
+	struct node *n;
+
+	if (b[0] != '%')
+		error("sync");
+	if (b[1] == '^' || b[1] == '[') {
+		n = load_tree();
+		scan_tree(n);
+		free_tree(n);
+		return;
+	}
+	if (b[1] != 'H')
+		error("unknown block");
+	xread(0, &h, sizeof(struct header));
+	switch (h.h_type) {
+	case H_EXPORT:
+		scan_export = h.h_name;
+		return;
+	case H_FUNCTION:
+		printf("%c %s\n", scan_export == h.h_data ? 'F' : 'S',
+			namestr(h.h_data));
+		break;
+	case H_FUNCTION | H_FOOTER:
+		printf("E\n");
+		break;
+	case H_STRING:
+		process_literal(h.h_name, 0);
+		break;
+	}
+	scan_export = 0;
+}
+
 /*
  *	Entry point
  */
@@ -1048,9 +1781,35 @@ void codegen_lr(struct node *n)
 int main(int argc, char *argv[])
 {
 	uint8_t h[2];
+	unsigned scan = 0;
 
 	argv0 = argv[0];
 
+	while (argc > 1 && *argv[1] == '-') {
+		if (strcmp(argv[1], "-r") == 0)
+			scan = 1;
+		else if (strcmp(argv[1], "-d") == 0 && argc > 2) {
+			load_dead(argv[2]);
+			argv++;
+			argc--;
+		} else if ((strcmp(argv[1], "-c") == 0 || strcmp(argv[1], "-C") == 0) && argc > 2) {
+			fc_dir = argv[2];
+			fc_copt = argv[1][1] == 'C';
+			argv++;
+			argc--;
+		} else if (strcmp(argv[1], "-k") == 0 && argc > 2) {
+			fc_salt = argv[2];
+			argv++;
+			argc--;
+		} else
+			error("arguments");
+		argv++;
+		argc--;
+	}
+	/* We keep the cache by reading back what we wrote */
+	if (fc_dir && !fc_copt && lseek(1, 0, SEEK_CUR) == -1)
+		fc_dir = NULL;
+
 	/* We can make this better later */
 	if (argc != 4 && argc != 5)
 		error("arguments");
@@ -1065,13 +1824,29 @@ int main(int argc, char *argv[])
 		error("invalid optimizer level");
 	if (argv[4])
 		codeseg = argv[4];
+#ifndef ARENA
 	init_name_cache();
-	load_symbols(argv[1]);
+#endif
+	sym_path = argv[1];
 	init_nodes();
 
+	xread(0, h, 2);
+	if (h[0] != '%' || h[1] != 'V')
+		error("sync");
+	xread(0, h, 1);
+	if (h[0] != TREE_VERSION)
+		error("tree version");
+
+	if (scan) {
+		while (xread_eof(0, &h, 2))
+			scan_block(h);
+		return 0;
+	}
 	gen_start();
-	while (read(0, &h, 2) > 0) {
+	while (xread_eof(0, &h, 2)) {
 		process_one_block(h);
 	}
 	gen_end();
+	if (fc_dir && !fc_copt)
+		fc_prune();
 }
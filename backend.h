@@ -3,6 +3,7 @@ extern unsigned cpu;
 extern unsigned opt;
 extern unsigned optsize;
 extern const char *codeseg;
+extern unsigned xlabel;
 
 extern void error(const char *p);
 
@@ -67,3 +68,4 @@ extern unsigned gen_shortcut(struct node *n);
 #define MAX_SEG		3
 
 extern unsigned func_flags;
+extern unsigned fast_divide;
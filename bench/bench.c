@@ -0,0 +1,503 @@
+/*
+ *	Compiler throughput benchmark
+ *
+ *	bench [-d dir] [-s scale,...] [-n runs] [-c cpu,...] [-o results]
+ *	      [-b baseline] [-t percent]
+ *
+ *	Generates synthetic C sources aimed at the places the compiler is
+ *	likely to hurt: lots of functions, expressions close to the node
+ *	limit, big switches, a symbol table nearly full of globals and large
+ *	initialized arrays, at each of the scales asked for. The counts are
+ *	held under the compiler limits however big the scale, for the rest the
+ *	input just gets longer. Each one is put through cc0, cc1, cc2 and copt
+ *	for each backend and the CPU time of every pass is recorded. The best
+ *	of the runs is kept, which is a lot steadier than a single run.
+ *
+ *	The results are written one line per case, backend and pass. If a
+ *	baseline of the same form is given we compare the total for each pass
+ *	and backend over all the cases against it, as single small cases are
+ *	too noisy to judge, and exit with an error if any of them is more than
+ *	the allowed percentage slower. A pass that fails, a baseline we can't
+ *	read or one with nothing to compare against are errors too.
+ *
+ *	The passes are run straight from the build directory (-d) so this
+ *	needs no installed compiler.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* Keep clear of the compiler limits (see compiler.h) */
+#define MAXSYM		768
+#define NUM_NODES	100
+#define NUM_SWITCH	128
+
+struct backend {
+	const char *name;
+	const char *cc1;
+	const char *cc2;
+	const char *code;	/* cc2 cpu code */
+	const char *rules;	/* NULL if there is no copt stage */
+};
+
+static struct backend backends[] = {
+	{ "8080", "cc1.8080", "cc2.8080", "8080", "rules.8080" },
+	{ "z80", "cc1.z80", "cc2.z80", "80", "rules.z80" },
+	{ "6502", "cc1.6502", "cc2.6502", "0", "rules.6502" },
+	{ "65c816", "cc1.65c816", "cc2.65c816", "0", "rules.65c816" },
+	{ "6800", "cc1.6800", "cc2.6800", "6800", "rules.6800" },
+	{ "z8", "cc1.z8", "cc2.z8", "8", "rules.z8" },
+	{ "super8", "cc1.super8", "cc2.super8", "8", "rules.super8" },
+	{ "1802", "cc1.1802", "cc2.1802", "2", "rules.1802" },
+	{ "8070", "cc1.8070", "cc2.8070", "8070", NULL },
+	{ NULL }
+};
+
+static const char *passname[4] = { "cc0", "cc1", "cc2", "copt" };
+
+static const char *dir = "..";
+static const char *scales = "1,10";
+static unsigned scale;
+static unsigned runs = 5;
+static const char *cpus;
+static const char *resname = "results.txt";
+static const char *basefile;
+static unsigned slack = 25;
+
+static FILE *out;
+static FILE *res;
+
+#define NBACKEND	(sizeof(backends) / sizeof(struct backend) - 1)
+
+static long total[NBACKEND][4];		/* Sums of cases in the baseline */
+static long total_old[NBACKEND][4];
+static unsigned failures;
+static unsigned compared;
+
+/*
+ *	Source generators. Each writes a complete C file for the scale.
+ */
+
+/* Many small functions, each a symbol of its own */
+static void gen_funcs(void)
+{
+	unsigned n = 60 * scale;
+	unsigned i;
+
+	if (n > MAXSYM - 68)
+		n = MAXSYM - 68;
+	fprintf(out, "int total;\n\n");
+	for (i = 0; i < n; i++) {
+		fprintf(out, "int f%u(int a, int b)\n{\n", i);
+		fprintf(out, "\tint c = a + %u;\n", i);
+		fprintf(out, "\twhile (b--)\n\t\tc += a * b;\n");
+		fprintf(out, "\tif (c > %u)\n\t\ttotal++;\n", i * 3);
+		if (i)
+			fprintf(out, "\treturn c + f%u(b, a);\n}\n\n", i - 1);
+		else
+			fprintf(out, "\treturn c;\n}\n\n");
+	}
+}
+
+/* Expressions that use most of the node table */
+static void gen_nest(void)
+{
+	unsigned n = 20 * scale;
+	/* Each step is an operator and a leaf, and a global leaf is a name
+	   and a dereference */
+	unsigned depth = (NUM_NODES - 10) / 3;
+	unsigned i, j;
+
+	fprintf(out, "int x, y, z;\n\n");
+	for (i = 0; i < n; i++) {
+		fprintf(out, "int nest%u(int a, int b)\n{\n\treturn ", i);
+		for (j = 0; j < depth; j++)
+			fprintf(out, "(%c %c ", "abxyz"[j % 5], "+-*&|^"[j % 6]);
+		fprintf(out, "%u", i);
+		for (j = 0; j < depth; j++)
+			fputc(')', out);
+		fprintf(out, ";\n}\n\n");
+	}
+}
+
+/* Switches as big as the compiler allows */
+static void gen_switch(void)
+{
+	unsigned n = 10 * scale;
+	unsigned i, j;
+
+	for (i = 0; i < n; i++) {
+		fprintf(out, "int sw%u(int a)\n{\n\tswitch (a) {\n", i);
+		for (j = 0; j < NUM_SWITCH - 8; j++)
+			fprintf(out, "\tcase %u:\n\t\treturn %u;\n",
+				j * 3 + i, (j * 7) ^ i);
+		fprintf(out, "\t}\n\treturn -1;\n}\n\n");
+	}
+}
+
+/* A symbol table close to full of globals */
+static void gen_globals(void)
+{
+	unsigned n = 50 * scale;
+	unsigned i;
+
+	if (n > MAXSYM - 68)
+		n = MAXSYM - 68;
+	for (i = 0; i < n; i++)
+		fprintf(out, "%s g%u;\n", i & 1 ? "int" : "char", i);
+	fprintf(out, "\nint sum(void)\n{\n\tint s = 0;\n");
+	for (i = 0; i < n; i++)
+		fprintf(out, "\ts += g%u;\n", i);
+	fprintf(out, "\treturn s;\n}\n");
+}
+
+/* Large initialized arrays and strings */
+static void gen_init(void)
+{
+	unsigned n = 2000 * scale;
+	unsigned i;
+
+	/* Much more than this and cc0 runs out of room */
+	if (n > 8000)
+		n = 8000;
+	fprintf(out, "unsigned int table[] = {\n");
+	for (i = 0; i < n; i++)
+		fprintf(out, "\t%u,\n", (i * 2654435761U) & 0xFFFF);
+	fprintf(out, "};\n\nunsigned char bytes[] = {\n");
+	for (i = 0; i < n; i++)
+		fprintf(out, "\t0x%02X,\n", (i * 31) & 0xFF);
+	fprintf(out, "};\n\nchar *strs[] = {\n");
+	for (i = 0; i < n / 10; i++)
+		fprintf(out, "\t\"string number %u\",\n", i);
+	fprintf(out, "};\n");
+}
+
+struct bcase {
+	const char *name;
+	void (*gen)(void);
+};
+
+static struct bcase cases[] = {
+	{ "funcs", gen_funcs },
+	{ "nest", gen_nest },
+	{ "switch", gen_switch },
+	{ "globals", gen_globals },
+	{ "init", gen_init },
+	{ NULL }
+};
+
+/*
+ *	Running and timing the passes
+ */
+
+static char *tool(const char *name)
+{
+	static char buf[4][512];
+	static unsigned n;
+	char *p = buf[n++ & 3];
+	snprintf(p, 512, "%s/%s", dir, name);
+	return p;
+}
+
+/* Run a pass with redirections and return the CPU time it took in
+   microseconds, or -1 if it failed */
+static long run(const char *in, const char *outf, char *const argv[])
+{
+	struct rusage ru;
+	pid_t pid;
+	int status;
+	int fd;
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		fd = open(in, O_RDONLY);
+		if (fd == -1) {
+			perror(in);
+			_exit(255);
+		}
+		dup2(fd, 0);
+		close(fd);
+		/* cc1 reads back what it wrote */
+		fd = open(outf, O_RDWR | O_CREAT | O_TRUNC, 0666);
+		if (fd == -1) {
+			perror(outf);
+			_exit(255);
+		}
+		dup2(fd, 1);
+		close(fd);
+		/* We only care about the passes that work */
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, 2);
+		close(fd);
+		execv(argv[0], argv);
+		_exit(255);
+	}
+	if (wait4(pid, &status, 0, &ru) == -1) {
+		perror("wait4");
+		exit(1);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return -1;
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000L
+		+ ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/* Look up a result in the baseline */
+static long baseline(const char *c, const char *b, const char *p)
+{
+	static char line[128];
+	char cn[32], bn[32], pn[32];
+	long t;
+	FILE *f;
+
+	if (basefile == NULL || (f = fopen(basefile, "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%31s %31s %31s %ld", cn, bn, pn, &t) == 4 &&
+		    strcmp(cn, c) == 0 && strcmp(bn, b) == 0 && strcmp(pn, p) == 0) {
+			fclose(f);
+			return t;
+		}
+	}
+	fclose(f);
+	return -1;
+}
+
+static void report(struct bcase *c, struct backend *b, unsigned p, long t)
+{
+	char name[32];
+	long old;
+
+	snprintf(name, sizeof(name), "%s@%u", c->name, scale);
+	if (t == -1)
+		return;
+	if (t == -2) {
+		printf("  %-12s %-8s %-5s   failed\n", name, b->name, passname[p]);
+		failures++;
+		return;
+	}
+	fprintf(res, "%s %s %s %ld\n", name, b->name, passname[p], t);
+	old = baseline(name, b->name, passname[p]);
+	printf("  %-12s %-8s %-5s %8ld.%03ldms", name, b->name, passname[p],
+		t / 1000, t % 1000);
+	if (old > 0) {
+		printf("  %+4ld%%", (t - old) * 100 / old);
+		total[b - backends][p] += t;
+		total_old[b - backends][p] += old;
+	}
+	putchar('\n');
+}
+
+/* Compare the totals with the baseline and count the regressions */
+static unsigned summary(void)
+{
+	unsigned n = 0;
+	unsigned i, p;
+	long t, old;
+
+	if (basefile == NULL)
+		return 0;
+	printf("\nTotals against %s:\n", basefile);
+	for (i = 0; i < NBACKEND; i++) {
+		for (p = 0; p < 4; p++) {
+			t = total[i][p];
+			old = total_old[i][p];
+			if (old == 0)
+				continue;
+			compared++;
+			printf("  %-8s %-5s %8ld.%03ldms  %+4ld%%", backends[i].name,
+				passname[p], t / 1000, t % 1000, (t - old) * 100 / old);
+			if (t > old + old * slack / 100) {
+				printf("  REGRESSION");
+				n++;
+			}
+			putchar('\n');
+		}
+	}
+	if (compared == 0)
+		printf("  nothing in the baseline matches these results\n");
+	return n;
+}
+
+/* Keep the best time. A failure counts against every run so that a pass
+   that only works sometimes shows up */
+static unsigned keep(long *best, long t)
+{
+	if (t == -1) {
+		*best = -2;
+		return 0;
+	}
+	if (*best == -1 || t < *best)
+		*best = t;
+	return 1;
+}
+
+static void bench_case(struct bcase *c, struct backend *b, unsigned first)
+{
+	long best[4];
+	unsigned r, p;
+	char *argv[6];
+	char rules[512];
+
+	for (p = 0; p < 4; p++)
+		best[p] = -1;
+
+	for (r = 0; r < runs; r++) {
+		argv[0] = tool("cc0");
+		argv[1] = "work.sym";
+		argv[2] = NULL;
+		if (!keep(&best[0], run("work.c", "work.@", argv)))
+			break;
+
+		argv[0] = tool(b->cc1);
+		argv[1] = NULL;
+		if (!keep(&best[1], run("work.@", "work.#", argv)))
+			break;
+
+		argv[0] = tool(b->cc2);
+		argv[1] = "work.sym";
+		argv[2] = (char *)b->code;
+		argv[3] = "2";
+		argv[4] = NULL;
+		if (!keep(&best[2], run("work.#", "work.^", argv)))
+			break;
+
+		if (b->rules == NULL)
+			continue;
+		argv[0] = tool("copt");
+		snprintf(rules, sizeof(rules), "%s/%s", dir, b->rules);
+		argv[1] = rules;
+		argv[2] = NULL;
+		if (!keep(&best[3], run("work.^", "work.s", argv)))
+			break;
+	}
+	/* cc0 doesn't depend on the backend so only report it once */
+	if (first)
+		report(c, b, 0, best[0]);
+	report(c, b, 1, best[1]);
+	report(c, b, 2, best[2]);
+	if (b->rules)
+		report(c, b, 3, best[3]);
+}
+
+static unsigned wanted(struct backend *b)
+{
+	const char *p = cpus;
+	size_t l = strlen(b->name);
+
+	if (p == NULL)
+		return 1;
+	while (*p) {
+		if (strncmp(p, b->name, l) == 0 && (p[l] == ',' || p[l] == 0))
+			return 1;
+		p = strchr(p, ',');
+		if (p == NULL)
+			break;
+		p++;
+	}
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: bench [-d dir] [-s scale,...] [-n runs] [-c cpu,...] [-o results] [-b baseline] [-t percent]\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bcase *c;
+	struct backend *b;
+	const char *p;
+	unsigned first;
+	unsigned regressions;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:s:n:c:o:b:t:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 's':
+			scales = optarg;
+			break;
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'c':
+			cpus = optarg;
+			break;
+		case 'o':
+			resname = optarg;
+			break;
+		case 'b':
+			basefile = optarg;
+			break;
+		case 't':
+			slack = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc || runs < 1)
+		usage();
+	if (basefile && access(basefile, R_OK)) {
+		perror(basefile);
+		fprintf(stderr, "bench: make a baseline first with -o (make bench-baseline).\n");
+		exit(1);
+	}
+
+	res = fopen(resname, "w");
+	if (res == NULL) {
+		perror(resname);
+		exit(1);
+	}
+	for (p = scales; p; p = strchr(p, ',')) {
+		if (*p == ',')
+			p++;
+		scale = atoi(p);
+		if (scale < 1)
+			usage();
+		for (c = cases; c->name; c++) {
+			out = fopen("work.c", "w");
+			if (out == NULL) {
+				perror("work.c");
+				exit(1);
+			}
+			c->gen();
+			fclose(out);
+			first = 1;
+			for (b = backends; b->name; b++) {
+				if (wanted(b)) {
+					bench_case(c, b, first);
+					first = 0;
+				}
+			}
+		}
+	}
+	fclose(res);
+	unlink("work.c");
+	unlink("work.sym");
+	unlink("work.@");
+	unlink("work.#");
+	unlink("work.^");
+	unlink("work.s");
+	regressions = summary();
+	if (regressions)
+		printf("%u passes slower than the baseline.\n", regressions);
+	if (failures)
+		printf("%u passes failed.\n", failures);
+	return regressions || failures || (basefile && !compared);
+}
@@ -409,8 +409,13 @@ void function_body(unsigned st, unsigned name, unsigned type)
 
 	statement_block(1);
 
+	/* We don't track which objects are volatile, just that some are */
+	if (voltrack)
+		func_flags |= F_VOLATILE;
+
 	footer(H_FUNCTION, func_tag, name);
 
 	rewrite_header(hrw, H_FRAME, frame_size(), func_flags);
 	check_labels();
+	reset_nodes();
 }
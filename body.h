@@ -7,6 +7,7 @@ extern unsigned arg_flags;
 #define F_VOIDRET		1
 #define F_VOID			2
 #define F_VARARG		4
+#define F_VOLATILE		8	/* Mentions volatile so locals may be */
 
 /* Registers start at 1 and bit 8 to 15 */
 #define F_REG(n)		(1 << (n + 7))
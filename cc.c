@@ -52,10 +52,21 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <dirent.h>
+#include <utime.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#if defined(__linux__)
+#define TIMING
+#define COPT_SERVER
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
 /*
  *	For all non native compilers the directories moved and the rules 
  *	are
@@ -70,6 +81,7 @@
  *		cpp		(shared by all)
  *		cc0		(possibly shared may need work)
  *		cc1.cpuid
+ *		cc1b		(shared by all, -O2 and up)
  *		cc2.cpuid
  *		copt		(shared by all)
  *		copt.cpuname
@@ -198,6 +210,8 @@ unsigned has_relocs;		/* Do we have relocations ? */
 const char *crtname = "crt0.o";
 
 int keep_temp;
+int pipe_mode;
+unsigned jobs = 1;
 int last_phase = 4;
 int only_one_input;
 char *target;
@@ -206,6 +220,16 @@ int c_files;
 int standalone;
 char *cpu = "8080";
 int mapfile;
+int make_deps;			/* -MD */
+int dep_phony;			/* -MP */
+char *depfile;			/* -MF */
+char *cachedir;
+int time_table;			/* -time */
+char *time_file;		/* -ftime-report= */
+#ifdef COPT_SERVER
+char *copt_server;		/* --copt-server= */
+#endif
+unsigned long cachesize = 32768;	/* Kilobytes */
 
 #define OS_NONE		0
 #define OS_FUZIX	1
@@ -215,6 +239,14 @@ char optimize = '0';
 char *codeseg;
 
 char *symtab;
+int whole_prog;			/* -fwhole-program */
+int wp_scan;			/* Ask cc2 for references not code */
+char *deadlist;			/* Functions cc2 can leave out */
+int func_cache;			/* --function-cache */
+int int_cpp;			/* -fintegrated-cpp */
+int cc0_cpp;			/* cc0 preprocesses this unit itself */
+char *fc_dir;			/* Function cache for this unit */
+char fc_salt[17];		/* Compiler and options it was made with */
 
 #define MAXARG	512
 
@@ -258,6 +290,15 @@ static char *xstrdup(char *p, int extra)
 	return n;
 }
 
+static void *grow(void *p, unsigned *max, unsigned size)
+{
+	*max = *max ? 2 * *max : 64;
+	p = realloc(p, *max * size);
+	if (p == NULL)
+		memory();
+	return p;
+}
+
 #define CPATHSIZE	256
 
 static char pathbuf[CPATHSIZE];
@@ -426,10 +467,253 @@ static void resolve_libraries(void)
 	}
 }
 
-static void run_command(void)
+/*
+ *	-time and -ftime-report. Every command we run logs a line with its
+ *	phase, what it cost and the unit it was working on. The log is an
+ *	unlinked temporary file so that -j copies of ourself share it and we
+ *	can add the whole lot up at the end.
+ */
+
+#ifdef TIMING
+
+#define MAXTIMED	8	/* Commands running at once, see MAXSTAGE */
+#define MAXPHASE	16
+
+struct phase_time {
+	char name[16];
+	unsigned runs;
+	long wall;		/* All times in microseconds */
+	long user;
+	long sys;
+	long maxrss;		/* Kilobytes */
+};
+
+static FILE *time_log;
+static char time_unit[CPATHSIZE];
+static pid_t timed_pid[MAXTIMED];
+static struct phase_time phase_time[MAXPHASE];
+static unsigned num_phase;
+
+static struct timeval timed_start[MAXTIMED];
+static struct timeval time_begin;
+
+static const char *phase_names[] = {
+	"cpp", "cc0", "cc1b", "cc1", "cc2", "copt", "as", "ld", "reloc", NULL
+};
+
+/* The tool names carry the CPU so turn them back into the phase */
+static const char *phase_of(const char *cmd)
 {
-	pid_t pid, p;
-	int status;
+	const char **p = phase_names;
+	const char *b = strrchr(cmd, '/');
+
+	if (b)
+		cmd = b + 1;
+	while (*p) {
+		if (strncmp(cmd, *p, strlen(*p)) == 0)
+			return *p;
+		p++;
+	}
+	return cmd;
+}
+
+static long usec(struct timeval *t)
+{
+	return t->tv_sec * 1000000L + t->tv_usec;
+}
+
+static void time_start(pid_t pid)
+{
+	unsigned i;
+	for (i = 0; i < MAXTIMED; i++) {
+		if (timed_pid[i] == 0) {
+			timed_pid[i] = pid;
+			gettimeofday(&timed_start[i], NULL);
+			return;
+		}
+	}
+}
+
+static void time_record(pid_t pid, const char *name, struct rusage *ru)
+{
+	static char buf[CPATHSIZE + 64];
+	struct timeval now;
+	unsigned i;
+	int n;
+
+	gettimeofday(&now, NULL);
+	for (i = 0; i < MAXTIMED; i++)
+		if (timed_pid[i] == pid)
+			break;
+	if (i == MAXTIMED)
+		return;
+	timed_pid[i] = 0;
+	/* One write per record so that -j copies don't interleave */
+	n = snprintf(buf, sizeof(buf), "%s %ld %ld %ld %ld %s\n",
+		phase_of(name), usec(&now) - usec(&timed_start[i]),
+		usec(&ru->ru_utime), usec(&ru->ru_stime), ru->ru_maxrss,
+		*time_unit ? time_unit : "-");
+	if (n > 0 && n < (int)sizeof(buf))
+		write(fileno(time_log), buf, n);
+}
+
+static void time_init(void)
+{
+	time_log = tmpfile();
+	if (time_log == NULL) {
+		perror("tmpfile");
+		fatal();
+	}
+	fcntl(fileno(time_log), F_SETFD, FD_CLOEXEC);
+	fcntl(fileno(time_log), F_SETFL, O_APPEND);
+	gettimeofday(&time_begin, NULL);
+}
+
+static struct phase_time *find_phase(const char *name)
+{
+	struct phase_time *p = phase_time;
+	unsigned i;
+
+	for (i = 0; i < num_phase; i++, p++)
+		if (strcmp(p->name, name) == 0)
+			return p;
+	if (num_phase == MAXPHASE)
+		return NULL;
+	num_phase++;
+	snprintf(p->name, sizeof(p->name), "%s", name);
+	return p;
+}
+
+static void json_string(FILE *f, const char *p)
+{
+	putc('"', f);
+	while (*p) {
+		if (*p == '"' || *p == '\\')
+			putc('\\', f);
+		if ((uint8_t)*p < ' ')
+			fprintf(f, "\\u%04x", *p);
+		else
+			putc(*p, f);
+		p++;
+	}
+	putc('"', f);
+}
+
+static void json_times(FILE *f, long wall, long user, long sys, long rss)
+{
+	fprintf(f, "\"wall\": %ld.%06ld, \"user\": %ld.%06ld, "
+		"\"sys\": %ld.%06ld, \"maxrss\": %ld",
+		wall / 1000000L, wall % 1000000L, user / 1000000L,
+		user % 1000000L, sys / 1000000L, sys % 1000000L, rss);
+}
+
+static void table_time(long t)
+{
+	fprintf(stderr, " %6ld.%03ld", t / 1000000L, (t / 1000) % 1000);
+}
+
+static void time_report(void)
+{
+	static char buf[CPATHSIZE + 64];
+	static char name[16];
+	static char unit[CPATHSIZE];
+	struct phase_time *p;
+	long wall, user, sys, rss;
+	FILE *json = NULL;
+	unsigned i;
+	const char *sep = "";
+	long elapsed;
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	elapsed = usec(&now) - usec(&time_begin);
+
+	if (time_file) {
+		json = fopen(time_file, "w");
+		if (json == NULL) {
+			perror(time_file);
+			fatal();
+		}
+		fprintf(json, "{\n  \"records\": [");
+	}
+	rewind(time_log);
+	while (fgets(buf, sizeof(buf), time_log)) {
+		if (sscanf(buf, "%15s %ld %ld %ld %ld %[^\n]", name, &wall,
+			&user, &sys, &rss, unit) != 6)
+			continue;
+		p = find_phase(name);
+		if (p) {
+			p->runs++;
+			p->wall += wall;
+			p->user += user;
+			p->sys += sys;
+			if (rss > p->maxrss)
+				p->maxrss = rss;
+		}
+		if (json) {
+			fprintf(json, "%s\n    { \"phase\": ", sep);
+			json_string(json, name);
+			fprintf(json, ", \"file\": ");
+			json_string(json, unit);
+			fprintf(json, ", ");
+			json_times(json, wall, user, sys, rss);
+			fprintf(json, " }");
+			sep = ",";
+		}
+	}
+	fclose(time_log);
+
+	if (json) {
+		fprintf(json, "\n  ],\n  \"phases\": [");
+		sep = "";
+		for (i = 0, p = phase_time; i < num_phase; i++, p++) {
+			fprintf(json, "%s\n    { \"phase\": ", sep);
+			json_string(json, p->name);
+			fprintf(json, ", \"runs\": %u, ", p->runs);
+			json_times(json, p->wall, p->user, p->sys, p->maxrss);
+			fprintf(json, " }");
+			sep = ",";
+		}
+		fprintf(json, "\n  ],\n  \"elapsed\": %ld.%06ld\n}\n",
+			elapsed / 1000000L, elapsed % 1000000L);
+		if (fclose(json)) {
+			perror(time_file);
+			fatal();
+		}
+	}
+	if (!time_table)
+		return;
+	fprintf(stderr, "%-8s %6s %10s %10s %10s %10s\n",
+		"phase", "runs", "wall", "user", "sys", "maxrss");
+	for (i = 0, p = phase_time; i < num_phase; i++, p++) {
+		fprintf(stderr, "%-8s %6u", p->name, p->runs);
+		table_time(p->wall);
+		table_time(p->user);
+		table_time(p->sys);
+		fprintf(stderr, " %9ldK\n", p->maxrss);
+	}
+	fprintf(stderr, "%-8s %6s", "elapsed", "");
+	table_time(elapsed);
+	fputc('\n', stderr);
+}
+
+#else
+
+static void time_init(void)
+{
+	fprintf(stderr, "cc: timing is not supported on this host.\n");
+	fatal();
+}
+
+static void time_report(void)
+{
+}
+
+#endif
+
+static pid_t start_command(void)
+{
+	pid_t pid;
 
 	fflush(stdout);
 
@@ -463,28 +747,263 @@ static void run_command(void)
 		perror(arglist[0]);
 		exit(255);
 	}
+#ifdef TIMING
+	if (time_log)
+		time_start(pid);
+#endif
 	if (arginfd)
 		close(arginfd);
 	if (argoutfd)
 		close(argoutfd);
+	return pid;
+}
+
+/* Wait for a command to finish. Returns 0 if it was happy */
+static int reap_command(pid_t pid, const char *name)
+{
+	pid_t p;
+	int status;
+#ifdef TIMING
+	struct rusage ru;
+
+	while ((p = wait4(pid, &status, 0, &ru)) != pid) {
+#else
 	while ((p = waitpid(pid, &status, 0)) != pid) {
+#endif
 		if (p == -1) {
 			perror("waitpid");
 			fatal();
 		}
 	}
+#ifdef TIMING
+	if (time_log)
+		time_record(pid, name, &ru);
+#endif
 	if (WIFSIGNALED(status)) {
-		/* Scream loudly if it exploded */
-		fprintf(stderr, "cc: %s failed with signal %d.\n", arglist[0],
-			WTERMSIG(status));
-		fatal();
+		/* Scream loudly if it exploded. A broken pipe just means
+		   a later stage gave up so it has already complained */
+		if (WTERMSIG(status) != SIGPIPE)
+			fprintf(stderr, "cc: %s failed with signal %d.\n", name,
+				WTERMSIG(status));
+		return 1;
 	}
 	/* Quietly exit if the stage errors. That means it has reported
 	   things to the user */
-	if (WEXITSTATUS(status))
+	return WEXITSTATUS(status);
+}
+
+static void run_command(void)
+{
+	if (reap_command(start_command(), arglist[0]))
 		fatal();
 }
 
+/*
+ *	--copt-server: instead of running copt for each file hand the job to
+ *	a copt that stays around with its rules loaded. There is one server
+ *	per rules file at <path>.<cpu>, started by whoever needs it first,
+ *	and it goes away by itself once it has been idle for a while.
+ */
+
+#ifdef COPT_SERVER
+
+static int copt_sock = -1;	/* Connection for the job in progress */
+
+static void copt_start(const char *sock)
+{
+	pid_t pid = fork();
+	if (pid == -1)
+		return;
+	if (pid == 0) {
+		char *copt;
+		/* Detach it properly so it outlives us and never turns
+		   up in our wait() calls */
+		int fd = open("/dev/null", O_RDWR);
+		setsid();
+		if (fork())
+			_exit(0);
+		dup2(fd, 0);
+		dup2(fd, 1);
+		dup2(fd, 2);
+		copt = xstrdup(make_lib_name("copt", ""), 0);
+		execl(copt, copt, "-s", sock, make_lib_name("rules.", cpuset),
+			(char *)NULL);
+		_exit(255);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+static int copt_connect(void)
+{
+	static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	struct sockaddr_un sun;
+	unsigned tries;
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s.%s", copt_server, cpuset)
+		>= (int)sizeof(path))
+		return -1;
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	for (tries = 0; tries < 100; tries++) {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd == -1)
+			return -1;
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == 0)
+			return fd;
+		close(fd);
+		if (tries == 0)
+			copt_start(path);
+		usleep(10000);
+	}
+	return -1;
+}
+
+/* Hand copt's input and output to the server. If there isn't one to be
+   had then return 0 and the caller runs copt itself */
+static int copt_begin(int in, int out)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	union {
+		struct cmsghdr h;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} cbuf;
+	int fds[3];
+	char c = 0;
+
+	copt_sock = copt_connect();
+	if (copt_sock == -1)
+		return 0;
+	fds[0] = in;
+	fds[1] = out;
+	fds[2] = 2;
+	memset(&msg, 0, sizeof(msg));
+	memset(&cbuf, 0, sizeof(cbuf));
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+	if (sendmsg(copt_sock, &msg, 0) != 1) {
+		close(copt_sock);
+		copt_sock = -1;
+		return 0;
+	}
+	/* The server has its own copies now */
+	close(in);
+	close(out);
+	return 1;
+}
+
+/* Wait for the server to finish the job. Returns 0 if it went well */
+static int copt_end(void)
+{
+	uint8_t status;
+	int r = 1;
+
+	if (read(copt_sock, &status, 1) == 1)
+		r = status;
+	else
+		fprintf(stderr, "cc: copt server failed.\n");
+	close(copt_sock);
+	copt_sock = -1;
+	return r;
+}
+
+#endif
+
+/*
+ *	For -pipe the stages are all started together, each one reading
+ *	the output of the one before.
+ */
+
+#define MAXSTAGE	8
+
+static pid_t stage_pid[MAXSTAGE];
+static char *stage_name[MAXSTAGE];
+static unsigned num_stages;
+static int stage_fd = -1;	/* Read end of the pipe from the last stage */
+
+static void pipe_stage(unsigned last)
+{
+	int fd[2];
+
+	if (stage_fd != -1)
+		arginfd = stage_fd;
+	stage_fd = -1;
+	if (!last) {
+		if (pipe(fd) == -1) {
+			perror("pipe");
+			fatal();
+		}
+		/* Only the stages themselves should hold the pipe */
+		fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+		argoutfd = fd[1];
+		stage_fd = fd[0];
+	}
+	stage_name[num_stages] = xstrdup((char *)arglist[0], 0);
+	stage_pid[num_stages++] = start_command();
+}
+
+/* Wait for the whole chain. If any of it failed then the output is
+   garbage so remove it */
+static void pipe_wait(const char *out)
+{
+	unsigned i;
+	int err = 0;
+
+	for (i = 0; i < num_stages; i++) {
+		err |= reap_command(stage_pid[i], stage_name[i]);
+		free(stage_name[i]);
+	}
+	num_stages = 0;
+#ifdef COPT_SERVER
+	if (copt_sock != -1)
+		err |= copt_end();
+#endif
+	if (err) {
+		unlink(out);
+		fatal();
+	}
+}
+
+/* Run copt with the redirections already set up, via the server if
+   we can */
+static void run_copt(void)
+{
+#ifdef COPT_SERVER
+	if (copt_server && !fc_dir && copt_begin(arginfd, argoutfd)) {
+		if (copt_end())
+			fatal();
+		return;
+	}
+#endif
+	run_command();
+}
+
+/* The same for the last stage of a -pipe chain */
+static void pipe_copt(void)
+{
+#ifdef COPT_SERVER
+	if (copt_server && !fc_dir && copt_begin(stage_fd, argoutfd)) {
+		stage_fd = -1;
+		return;
+	}
+#endif
+	pipe_stage(1);
+}
+
 static void redirect_in(const char *p)
 {
 	arginfd = open(p, O_RDONLY);
@@ -526,31 +1045,52 @@ void convert_s_to_o(char *path)
 	pathmod(path, ".s", ".o", 5);
 }
 
-void convert_c_to_s(char *path)
+static void build_cpp(char *path)
 {
-	char *tmp, *t, *p;
-	char optstr[2];
+	build_arglist(make_lib_name("cpp", ""));
+
+	add_argument_list("-I", &inclist);
+	add_argument_list("-D", &deflist);
+	add_argument("-E");
+	add_argument(path);
+}
 
+/* The shared tree optimiser only runs at -O2 and up */
+static unsigned use_cc1b(void)
+{
+	return optimize == '2' || optimize == '3';
+}
 
+/* cc0 reads cpp output, or with -fintegrated-cpp the source itself */
+static void build_cc0(char *path)
+{
 	build_arglist(make_lib_name("cc0", ""));
+	if (cc0_cpp) {
+		add_argument_list("-I", &inclist);
+		add_argument_list("-D", &deflist);
+	}
 	add_argument(symtab);
-	t = xstrdup(path, 0);
-	tmp = pathmod(t, ".c", ".%", 0);
-	redirect_in(tmp);
-	t = xstrdup(path, 0);
-	tmp = pathmod(t, ".%", ".@", 0);
-	if (tmp == NULL)
-		memory();
-	redirect_out(tmp);
-	run_command();
-
-	build_arglist(make_lib_name("cc1", cpudot));
-	redirect_in(tmp);
-	tmp = pathmod(path, ".@", ".#", 0);
-	redirect_out(tmp);
-	run_command();
+	if (cc0_cpp)
+		add_argument(path);
+}
 
+static void build_cc2(char *optstr)
+{
 	build_arglist(make_lib_name("cc2", cpudot));
+	if (wp_scan)
+		add_argument("-r");
+	if (deadlist) {
+		add_argument("-d");
+		add_argument(deadlist);
+	}
+	/* At -O0 cc2 keeps the cache, otherwise copt does once it has
+	   optimized each function */
+	if (fc_dir && !wp_scan) {
+		add_argument(optimize == '0' ? "-c" : "-C");
+		add_argument(fc_dir);
+		add_argument("-k");
+		add_argument(fc_salt);
+	}
 	add_argument(symtab);
 	add_argument(cpucode);
 	/* FIXME: need to change backend.c parsing for above and also
@@ -560,11 +1100,120 @@ void convert_c_to_s(char *path)
 	add_argument(optstr);
 	if (codeseg)
 		add_argument(codeseg);
+}
+
+/* With --function-cache each unit keeps its cache in a directory next to
+   its output */
+static void function_cache(char *path)
+{
+	free(fc_dir);
+	fc_dir = NULL;
+	if (!func_cache)
+		return;
+	fc_dir = pathmod(xstrdup(path, 3), "", ".fc", 5);
+	if (mkdir(fc_dir, 0777) == -1 && access(fc_dir, W_OK) == -1) {
+		perror(fc_dir);
+		fatal();
+	}
+}
+
+static void copt_arguments(void)
+{
+	if (fc_dir) {
+		add_argument("-c");
+		add_argument(fc_dir);
+	}
+	add_argument(make_lib_name("rules.", cpuset));
+}
+
+/* Run the whole chain from the C source (or the .% if pp is set) to the
+   .s file at once */
+static void convert_c_to_s_piped(char *path, unsigned pp)
+{
+	char *p;
+	char optstr[2];
+
+	if (!pp) {
+		build_cpp(path);
+		pipe_stage(0);
+	}
+
+	build_cc0(path);
+	if (pp && !cc0_cpp) {
+		p = xstrdup(path, 0);
+		redirect_in(pathmod(p, ".c", ".%", 0));
+		free(p);
+	}
+	pipe_stage(0);
+
+	build_arglist(make_lib_name("cc1", cpudot));
+	pipe_stage(0);
+
+	if (use_cc1b()) {
+		build_arglist(make_lib_name("cc1b", ""));
+		pipe_stage(0);
+	}
+
+	function_cache(path);
+	build_cc2(optstr);
+	if (optimize == '0') {
+		redirect_out(pathmod(path, ".c", ".s", 2));
+		pipe_stage(1);
+		pipe_wait(path);
+		return;
+	}
+	pipe_stage(0);
+
+	p = xstrdup(make_lib_name("copt", ""), 0);
+	build_arglist(p);
+	copt_arguments();
+	redirect_out(pathmod(path, ".c", ".s", 2));
+	pipe_copt();
+	pipe_wait(path);
+	free(p);
+}
+
+/* cc0 and cc1 turn the .% into a .#, with cc1b tidying the trees */
+static void convert_c_to_tree(char *path, int rmif)
+{
+	char *tmp, *t;
+
+	build_cc0(path);
+	t = xstrdup(path, 0);
+	tmp = pathmod(t, ".c", ".%", 0);
+	if (!cc0_cpp)
+		redirect_in(tmp);
+	tmp = pathmod(t, ".%", ".@", 0);
+	redirect_out(tmp);
+	run_command();
+
+	build_arglist(make_lib_name("cc1", cpudot));
 	redirect_in(tmp);
+	if (use_cc1b()) {
+		/* The redirects are already open so the name can be reused */
+		tmp = pathmod(t, ".@", ".+", 0);
+		redirect_out(tmp);
+		run_command();
+		build_arglist(make_lib_name("cc1b", ""));
+		redirect_in(tmp);
+	}
+	redirect_out(pathmod(path, ".c", ".#", rmif));
+	run_command();
+	free(t);
+}
+
+/* cc2 and copt turn the .# into the .s */
+static void convert_tree_to_s(char *path)
+{
+	char *tmp, *p;
+	char optstr[2];
+
+	function_cache(path);
+	build_cc2(optstr);
+	redirect_in(path);
 	if (optimize == '0') {
 		redirect_out(pathmod(path, ".#", ".s", 2));
 		run_command();
-		free(t);
 		return;
 	}
 	tmp = pathmod(path, ".#", ".^", 0);
@@ -574,14 +1223,19 @@ void convert_c_to_s(char *path)
 	/* TODO: with the new copt we may end up with a copt per cpu */
 	p = xstrdup(make_lib_name("copt", ""), 0);
 	build_arglist(p);
-	add_argument(make_lib_name("rules.", cpuset));
+	copt_arguments();
 	redirect_in(tmp);
 	redirect_out(pathmod(path, ".#", ".s", 2));
-	run_command();
-	free(t);
+	run_copt();
 	free(p);
 }
 
+void convert_c_to_s(char *path)
+{
+	convert_c_to_tree(path, 0);
+	convert_tree_to_s(path);
+}
+
 void convert_S_to_s(char *path)
 {
 	char *tmp;
@@ -598,12 +1252,7 @@ void preprocess_c(char *path)
 {
 	char *tmp;
 
-	build_arglist(make_lib_name("cpp", ""));
-
-	add_argument_list("-I", &inclist);
-	add_argument_list("-D", &deflist);
-	add_argument("-E");
-	add_argument(path);
+	build_cpp(path);
 	/* Weird one .. -E goes to stdout */
 	tmp = xstrdup(path, 0);
 	if (last_phase != 1)
@@ -611,6 +1260,94 @@ void preprocess_c(char *path)
 	run_command();
 }
 
+/*
+ *	-MD: write a make dependency file for each C source listing every
+ *	file the preprocessor read. We take them from its line markers.
+ */
+
+static void write_deps(char *src)
+{
+	static char line[512];
+	char **deps = NULL;
+	unsigned ndeps = 0;
+	unsigned maxdeps = 0;
+	unsigned i;
+	unsigned bol = 1;
+	char *pp, *obj, *p, *e;
+	FILE *in, *out;
+
+	pp = xstrdup(src, 0);
+	in = fopen(pathmod(pp, ".c", ".%", 5), "r");
+	if (in == NULL) {
+		perror(pp);
+		fatal();
+	}
+	deps = grow(deps, &maxdeps, sizeof(char *));
+	deps[ndeps++] = xstrdup(src, 0);
+	while (fgets(line, sizeof(line), in)) {
+		p = line;
+		/* Only look at the start of lines, even long ones */
+		i = bol;
+		bol = strchr(line, '\n') != NULL;
+		if (!i || *p++ != '#')
+			continue;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (strncmp(p, "line", 4) == 0)
+			p += 4;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p < '0' || *p > '9')
+			continue;
+		while (*p >= '0' && *p <= '9')
+			p++;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p++ != '"' || (e = strchr(p, '"')) == NULL)
+			continue;
+		*e = '\0';
+		/* <built-in> and friends are not files */
+		if (*p == '<')
+			continue;
+		for (i = 0; i < ndeps; i++)
+			if (strcmp(deps[i], p) == 0)
+				break;
+		if (i < ndeps)
+			continue;
+		if (ndeps == maxdeps)
+			deps = grow(deps, &maxdeps, sizeof(char *));
+		deps[ndeps++] = xstrdup(p, 0);
+	}
+	fclose(in);
+
+	if (depfile == NULL)
+		pathmod(pp, ".%", ".d", 5);
+	out = fopen(depfile ? depfile : pp, "w");
+	if (out == NULL) {
+		perror(depfile ? depfile : pp);
+		fatal();
+	}
+	obj = xstrdup(src, 0);
+	pathmod(obj, ".c", last_phase == 2 ? ".s" : ".o", 5);
+	fprintf(out, "%s:", obj);
+	for (i = 0; i < ndeps; i++)
+		fprintf(out, " \\\n %s", deps[i]);
+	fputc('\n', out);
+	/* -MP: so make doesn't stop when a header goes away */
+	if (dep_phony)
+		for (i = 1; i < ndeps; i++)
+			fprintf(out, "\n%s:\n", deps[i]);
+	if (fclose(out)) {
+		perror(depfile ? depfile : pp);
+		fatal();
+	}
+	for (i = 0; i < ndeps; i++)
+		free(deps[i]);
+	free(deps);
+	free(obj);
+	free(pp);
+}
+
 void link_phase(void)
 {
 	char *relocs = NULL;
@@ -667,6 +1404,9 @@ void link_phase(void)
 		add_argument("-R");
 		add_argument(relocs);
 	}
+#ifdef TIMING
+	snprintf(time_unit, CPATHSIZE, "%s", target);
+#endif
 	/* <root>/8080/lib/ */
 	l = xstrdup(make_lib_dir("", ""), 0);
 	printf("libpath '%s'\n", l);
@@ -699,8 +1439,285 @@ void link_phase(void)
 	}
 }
 
+/*
+ *	Compilation cache. A unit is looked up by a hash of the preprocessed
+ *	source along with everything else that decides the code we get: the
+ *	processor, the options and the compiler passes and rules themselves.
+ *	Entries are plain .s and .o files named by the hash. A hit touches the
+ *	entry so that when the cache grows too big the least recently used
+ *	ones go first.
+ *
+ *	The hash is a pair of 32bit hashes so the native compiler can build
+ *	this as well.
+ */
+
+struct hash {
+	uint32_t a;
+	uint32_t b;
+};
+
+static struct hash toolhash;	/* Options and compiler passes */
+static struct hash ashash;	/* Assembler, mixed in for objects */
+static int cache_obj;		/* Objects can be cached */
+static uint8_t iobuf[512];
+
+static void hash_bytes(struct hash *h, const uint8_t *p, unsigned len)
+{
+	while (len--) {
+		h->a = (h->a ^ *p) * 16777619UL;
+		h->b = *p++ + (h->b << 6) + (h->b << 16) - h->b;
+	}
+}
+
+static void hash_string(struct hash *h, const char *p)
+{
+	hash_bytes(h, (const uint8_t *)p, strlen(p) + 1);
+}
+
+static int hash_file(struct hash *h, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	int l;
+	if (fd == -1)
+		return 0;
+	while ((l = read(fd, iobuf, sizeof(iobuf))) > 0)
+		hash_bytes(h, iobuf, l);
+	close(fd);
+	return l == 0;
+}
+
+static int hash_tools(void)
+{
+	char optstr[2];
+
+	toolhash.a = 2166136261UL;
+	toolhash.b = 0;
+	optstr[0] = optimize;
+	optstr[1] = '\0';
+	hash_string(&toolhash, cpu);
+	hash_string(&toolhash, cpuset);
+	hash_string(&toolhash, cpucode);
+	hash_string(&toolhash, optstr);
+	hash_string(&toolhash, codeseg ? codeseg : "");
+	if (!hash_file(&toolhash, make_lib_name("cc0", "")))
+		return 0;
+	if (!hash_file(&toolhash, make_lib_name("cc1", cpudot)))
+		return 0;
+	if (use_cc1b() && !hash_file(&toolhash, make_lib_name("cc1b", "")))
+		return 0;
+	if (!hash_file(&toolhash, make_lib_name("cc2", cpudot)))
+		return 0;
+	if (optimize == '0')
+		return 1;
+	if (!hash_file(&toolhash, make_lib_name("copt", "")))
+		return 0;
+	return hash_file(&toolhash, make_lib_name("rules.", cpuset));
+}
+
+static void cache_init(void)
+{
+	if (mkdir(cachedir, 0777) == -1 && access(cachedir, W_OK) == -1) {
+		perror(cachedir);
+		fatal();
+	}
+	if (!hash_tools()) {
+		fprintf(stderr, "cc: cannot read compiler passes, not caching.\n");
+		cachedir = NULL;
+		return;
+	}
+	ashash = toolhash;
+	cache_obj = hash_file(&ashash, make_bin_name("as", cpuset));
+}
+
+static void function_cache_init(void)
+{
+	if (!hash_tools()) {
+		fprintf(stderr, "cc: cannot read compiler passes, not caching functions.\n");
+		func_cache = 0;
+		return;
+	}
+	sprintf(fc_salt, "%08lx%08lx",
+		(unsigned long)toolhash.a, (unsigned long)toolhash.b);
+}
+
+static char *cache_name(struct hash *h, const char *ext)
+{
+	static char buf[CPATHSIZE];
+	snprintf(buf, CPATHSIZE, "%s/%08lx%08lx%s", cachedir,
+		(unsigned long)h->a, (unsigned long)h->b, ext);
+	return buf;
+}
+
+static int copy_file(const char *from, const char *to)
+{
+	int in, out, l;
+
+	in = open(from, O_RDONLY);
+	if (in == -1)
+		return 0;
+	out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out == -1) {
+		close(in);
+		return 0;
+	}
+	while ((l = read(in, iobuf, sizeof(iobuf))) > 0) {
+		if (write(out, iobuf, l) != l) {
+			l = -1;
+			break;
+		}
+	}
+	close(in);
+	if (close(out) || l) {
+		unlink(to);
+		return 0;
+	}
+	return 1;
+}
+
+/* A running total of the cache size in Kb is kept in .size so we only
+   have to walk the directory when it looks like we have gone over. The
+   total is only approximate with several compiles at once, but each trim
+   puts it right */
+static unsigned long cache_size(long add, int set)
+{
+	static char name[CPATHSIZE];
+	unsigned long total = 0;
+	FILE *fp;
+
+	snprintf(name, CPATHSIZE, "%s/.size", cachedir);
+	if (!set && (fp = fopen(name, "r")) != NULL) {
+		if (fscanf(fp, "%lu", &total) != 1)
+			total = 0;
+		fclose(fp);
+	}
+	total += add;
+	fp = fopen(name, "w");
+	if (fp) {
+		fprintf(fp, "%lu\n", total);
+		fclose(fp);
+	}
+	return total;
+}
+
+/* Throw out the oldest entries until we fit */
+static void cache_trim(void)
+{
+	static char name[CPATHSIZE];
+	static char oldest[CPATHSIZE];
+	struct stat st;
+	struct dirent *d;
+	DIR *dp;
+	unsigned long total;
+	time_t age = 0;
+
+	do {
+		dp = opendir(cachedir);
+		if (dp == NULL)
+			return;
+		total = 0;
+		*oldest = 0;
+		while ((d = readdir(dp)) != NULL) {
+			if (*d->d_name == '.' || strncmp(d->d_name, "tmp", 3) == 0)
+				continue;
+			if (snprintf(name, CPATHSIZE, "%s/%s", cachedir,
+					d->d_name) >= CPATHSIZE)
+				continue;
+			if (stat(name, &st) || !S_ISREG(st.st_mode))
+				continue;
+			total += (st.st_size + 1023) / 1024;
+			if (*oldest == 0 || st.st_mtime < age) {
+				age = st.st_mtime;
+				strcpy(oldest, name);
+			}
+		}
+		closedir(dp);
+		if (total <= cachesize || *oldest == 0)
+			break;
+	} while (unlink(oldest) == 0);
+	cache_size(total, 1);
+}
+
+static int cache_fetch(struct hash *h, const char *ext, const char *to)
+{
+	char *n = cache_name(h, ext);
+	if (!copy_file(n, to))
+		return 0;
+	utime(n, NULL);
+	return 1;
+}
+
+/* Copy under a temporary name and rename so that other compiles sharing
+   the cache never see half an entry */
+static void cache_store(struct hash *h, const char *ext, const char *from)
+{
+	static char tmp[CPATHSIZE];
+	struct stat st;
+
+	snprintf(tmp, CPATHSIZE, "%s/tmp%x%s", cachedir, (unsigned)getpid(), ext);
+	if (!copy_file(from, tmp) || stat(tmp, &st))
+		return;
+	if (rename(tmp, cache_name(h, ext)) == -1) {
+		unlink(tmp);
+		return;
+	}
+	if (cache_size((st.st_size + 1023) / 1024, 0) > cachesize)
+		cache_trim();
+}
+
+static void compile_c_to_s(char *path)
+{
+	if (pipe_mode)
+		convert_c_to_s_piped(path, 1);
+	else
+		convert_c_to_s(path);
+}
+
+/* Turn a preprocessed unit into a .s, or a .o if we are going that far */
+static void cache_compile(struct obj *i)
+{
+	struct hash h, ho;
+	char *p = xstrdup(i->name, 0);
+
+	h = toolhash;
+	if (!hash_file(&h, pathmod(p, ".c", ".%", 5))) {
+		free(p);
+		compile_c_to_s(i->name);
+		i->type = TYPE_s;
+		return;
+	}
+	ho = h;
+	hash_bytes(&ho, (uint8_t *)&ashash, sizeof(ashash));
+
+	if (last_phase > 2 && cache_obj &&
+		cache_fetch(&ho, ".o", pathmod(p, ".%", ".o", 5))) {
+		pathmod(p, ".o", ".%", 0);
+		pathmod(i->name, ".c", ".o", 5);
+		i->type = TYPE_O;
+		free(p);
+		return;
+	}
+	if (cache_fetch(&h, ".s", pathmod(p, ".%", ".s", 5))) {
+		pathmod(p, ".s", ".%", 0);
+		pathmod(i->name, ".c", ".s", 2);
+	} else {
+		compile_c_to_s(i->name);
+		cache_store(&h, ".s", i->name);
+	}
+	i->type = TYPE_s;
+	free(p);
+
+	if (last_phase > 2 && cache_obj) {
+		convert_s_to_o(i->name);
+		cache_store(&ho, ".o", i->name);
+		i->type = TYPE_O;
+	}
+}
+
 void sequence(struct obj *i)
 {
+#ifdef TIMING
+	snprintf(time_unit, CPATHSIZE, "%s", i->name);
+#endif
 //	printf("Last Phase %d\n", last_phase);
 //	printf("1:Processing %s %d\n", i->name, i->type);
 	if (i->type == TYPE_S) {
@@ -708,6 +1725,22 @@ void sequence(struct obj *i)
 		i->type = TYPE_s;
 		i->used = 1;
 	}
+	/* With -fintegrated-cpp cc0 reads the source itself */
+	if (i->type == TYPE_C && int_cpp && last_phase > 1 && cachedir == NULL
+		&& !make_deps) {
+		cc0_cpp = 1;
+		compile_c_to_s(i->name);
+		cc0_cpp = 0;
+		i->type = TYPE_s;
+		i->used = 1;
+	}
+	/* With -pipe the preprocessor is just the first stage of the chain */
+	if (i->type == TYPE_C && pipe_mode && last_phase > 1 && cachedir == NULL
+		&& !make_deps) {
+		convert_c_to_s_piped(i->name, 0);
+		i->type = TYPE_s;
+		i->used = 1;
+	}
 	if (i->type == TYPE_C) {
 		preprocess_c(i->name);
 		i->type = TYPE_C_pp;
@@ -715,10 +1748,16 @@ void sequence(struct obj *i)
 	}
 	if (last_phase == 1)
 		return;
+	if (i->type == TYPE_C_pp && make_deps)
+		write_deps(i->name);
 //	printf("2:Processing %s %d\n", i->name, i->type);
 	if (i->type == TYPE_C_pp || i->type == TYPE_C) {
-		convert_c_to_s(i->name);
-		i->type = TYPE_s;
+		if (cachedir)
+			cache_compile(i);
+		else {
+			compile_c_to_s(i->name);
+			i->type = TYPE_s;
+		}
 		i->used = 1;
 	}
 	if (last_phase == 2)
@@ -731,14 +1770,352 @@ void sequence(struct obj *i)
 	}
 }
 
+/*
+ *	With -j each unit that needs compiling or assembling is handed to a
+ *	copy of ourself so that several can run at once. Each copy has its
+ *	own symbol table file. Once they are all done we link as usual.
+ */
+
+#define MAXJOBS		64
+
+static pid_t unit_pid[MAXJOBS];
+static struct obj *unit_obj[MAXJOBS];
+static unsigned num_units;
+static unsigned unit_failed;
+
+static void make_symtab(void)
+{
+	symtab = xstrdup(".symtmp", 16);
+	snprintf(symtab + 7, 16, "%x", getpid());
+}
+
+static unsigned needs_work(struct obj *i)
+{
+	if (i->type == TYPE_C || i->type == TYPE_S)
+		return 1;
+	if (i->type == TYPE_s && last_phase > 2)
+		return 1;
+	return 0;
+}
+
+/* The child did the work, bring our view of the object into line */
+static void unit_done(struct obj *i)
+{
+	char *x = strrchr(i->name, '.');
+	if (last_phase == 2) {
+		strcpy(x, ".s");
+		i->type = TYPE_s;
+	} else {
+		strcpy(x, ".o");
+		i->type = TYPE_O;
+	}
+	i->used = 1;
+}
+
+static void reap_unit(void)
+{
+	pid_t pid;
+	int status;
+	unsigned n;
+
+	pid = wait(&status);
+	if (pid == -1) {
+		perror("wait");
+		fatal();
+	}
+	for (n = 0; n < num_units; n++) {
+		if (unit_pid[n] == pid)
+			break;
+	}
+	/* Not one of ours */
+	if (n == num_units)
+		return;
+	if (WIFSIGNALED(status) || WEXITSTATUS(status))
+		unit_failed = 1;
+	else
+		unit_done(unit_obj[n]);
+	num_units--;
+	unit_pid[n] = unit_pid[num_units];
+	unit_obj[n] = unit_obj[num_units];
+}
+
+static void start_unit(struct obj *i)
+{
+	pid_t pid;
+
+	while (num_units == jobs)
+		reap_unit();
+	if (unit_failed)
+		return;
+	fflush(stdout);
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		fatal();
+	}
+	if (pid == 0) {
+		make_symtab();
+		sequence(i);
+		remove_temporaries();
+		unlink(symtab);
+		exit(0);
+	}
+	unit_pid[num_units] = pid;
+	unit_obj[num_units++] = i;
+}
+
+/*
+ *	-fwhole-program. The front end runs over every C file first and cc2
+ *	lists the functions each one defines and what they refer to. Anything
+ *	that can't be reached from main() or from data is then left out when
+ *	we generate the code. Functions only called from assembler are not
+ *	seen, so this is only for programs written in C. If we are not
+ *	linking, or main() is not in the C we were given, then the rest of
+ *	the program can call anything exported so only statics are dropped.
+ */
+
+#define WP_HASH		256
+
+struct wfunc {
+	char *name;
+	struct obj *unit;
+	unsigned first;		/* Its references in wref[] */
+	unsigned last;
+	int next;		/* Hash chain */
+	uint8_t global;
+	uint8_t live;
+};
+
+struct wref {
+	char *name;
+	struct obj *unit;
+	uint8_t root;		/* From data not a function */
+};
+
+static struct wfunc *wfunc;
+static unsigned num_wfunc, max_wfunc;
+static struct wref *wref;
+static unsigned num_wref, max_wref;
+static int wp_hash[WP_HASH];
+static int *wp_stack;
+static unsigned wp_sp;
+
+static unsigned wp_hashname(const char *p)
+{
+	unsigned h = 0;
+	while (*p)
+		h = h * 31 + *p++;
+	return h % WP_HASH;
+}
+
+/* A static in the same file wins over a global of the same name */
+static int wp_find(struct obj *unit, const char *name)
+{
+	int f = wp_hash[wp_hashname(name)];
+	int g = -1;
+	while (f != -1) {
+		if (strcmp(wfunc[f].name, name) == 0) {
+			if (wfunc[f].global)
+				g = f;
+			else if (wfunc[f].unit == unit)
+				return f;
+		}
+		f = wfunc[f].next;
+	}
+	return g;
+}
+
+static void wp_mark(struct obj *unit, const char *name)
+{
+	int f = wp_find(unit, name);
+	if (f != -1 && !wfunc[f].live) {
+		wfunc[f].live = 1;
+		wp_stack[wp_sp++] = f;
+	}
+}
+
+static char *unit_file(struct obj *i, char *ext)
+{
+	return pathmod(xstrdup(i->name, 2), ".c", ext, 5);
+}
+
+/* Read what cc2 -r found in a unit */
+static void wp_load(struct obj *i, char *name)
+{
+	static char buf[256];
+	struct wfunc *f = NULL;
+	unsigned h;
+	FILE *fp;
+	char *p;
+
+	fp = fopen(name, "r");
+	if (fp == NULL) {
+		perror(name);
+		fatal();
+	}
+	while (fgets(buf, sizeof(buf), fp)) {
+		p = strchr(buf, '\n');
+		if (p)
+			*p = 0;
+		switch (*buf) {
+		case 'F':
+		case 'S':
+			if (num_wfunc == max_wfunc)
+				wfunc = grow(wfunc, &max_wfunc, sizeof(struct wfunc));
+			f = wfunc + num_wfunc;
+			f->name = xstrdup(buf + 2, 0);
+			f->unit = i;
+			f->global = *buf == 'F';
+			f->live = 0;
+			f->first = f->last = num_wref;
+			h = wp_hashname(f->name);
+			f->next = wp_hash[h];
+			wp_hash[h] = num_wfunc++;
+			break;
+		case 'E':
+			if (f)
+				f->last = num_wref;
+			f = NULL;
+			break;
+		case 'R':
+			if (num_wref == max_wref)
+				wref = grow(wref, &max_wref, sizeof(struct wref));
+			wref[num_wref].name = xstrdup(buf + 2, 0);
+			wref[num_wref].unit = i;
+			wref[num_wref++].root = f == NULL;
+			break;
+		}
+	}
+	fclose(fp);
+}
+
+/* Work out what is live and give each unit the list of what isn't */
+static void wp_resolve(void)
+{
+	struct obj *i;
+	struct wfunc *f;
+	unsigned n;
+	FILE *fp;
+	char *name;
+
+	wp_stack = malloc((num_wfunc + 1) * sizeof(int));
+	if (wp_stack == NULL)
+		memory();
+	if (last_phase < 4 || wp_find(NULL, "main") == -1) {
+		for (n = 0; n < num_wfunc; n++)
+			if (wfunc[n].global)
+				wp_mark(wfunc[n].unit, wfunc[n].name);
+	} else
+		wp_mark(NULL, "main");
+	for (n = 0; n < num_wref; n++)
+		if (wref[n].root)
+			wp_mark(wref[n].unit, wref[n].name);
+	while (wp_sp) {
+		f = wfunc + wp_stack[--wp_sp];
+		for (n = f->first; n < f->last; n++)
+			wp_mark(f->unit, wref[n].name);
+	}
+
+	for (i = objlist.head; i; i = i->next) {
+		if (i->type != TYPE_C_pp)
+			continue;
+		name = unit_file(i, ".!");
+		fp = fopen(name, "w");
+		if (fp == NULL) {
+			perror(name);
+			fatal();
+		}
+		for (n = 0, f = wfunc; n < num_wfunc; n++, f++)
+			if (f->unit == i && !f->live)
+				fprintf(fp, "%s\n", f->name);
+		if (fclose(fp)) {
+			perror(name);
+			fatal();
+		}
+		free(name);
+	}
+}
+
+static void whole_program(void)
+{
+	struct obj *i;
+	char *save = symtab;
+	char *refs;
+	char optstr[2];
+
+	memset(wp_hash, 0xFF, sizeof(wp_hash));
+
+	/* Front end and scan. We keep each unit's .# and symbol table */
+	for (i = objlist.head; i; i = i->next) {
+		if (i->type != TYPE_C)
+			continue;
+		/* -MD needs the cpp output to find the headers */
+		if (!int_cpp || make_deps) {
+			preprocess_c(i->name);
+			if (make_deps)
+				write_deps(i->name);
+		}
+		i->type = TYPE_C_pp;
+		i->used = 1;
+		symtab = unit_file(i, ".&");
+		cc0_cpp = int_cpp && !make_deps;
+		convert_c_to_tree(i->name, 5);
+		cc0_cpp = 0;
+		wp_scan = 1;
+		build_cc2(optstr);
+		wp_scan = 0;
+		redirect_in(i->name);
+		refs = unit_file(i, ".=");
+		redirect_out(refs);
+		run_command();
+		wp_load(i, refs);
+		unlink(refs);
+		free(refs);
+		free(symtab);
+		symtab = save;
+		pathmod(i->name, ".#", ".c", 5);
+		remove_temporaries();
+	}
+
+	wp_resolve();
+
+	/* Now generate the code for what is left */
+	for (i = objlist.head; i; i = i->next) {
+		if (i->type == TYPE_C_pp) {
+			symtab = unit_file(i, ".&");
+			*rmptr++ = symtab;
+			deadlist = unit_file(i, ".!");
+			*rmptr++ = deadlist;
+			convert_tree_to_s(pathmod(i->name, ".c", ".#", 0));
+			i->type = TYPE_s;
+			symtab = save;
+			deadlist = NULL;
+		}
+		sequence(i);
+		remove_temporaries();
+	}
+}
+
 void processing_loop(void)
 {
 	struct obj *i = objlist.head;
+	if (whole_prog && last_phase > 1) {
+		whole_program();
+		i = NULL;
+	}
 	while (i) {
-		sequence(i);
-		remove_temporaries();
+		if (jobs > 1 && last_phase > 1 && needs_work(i))
+			start_unit(i);
+		else {
+			sequence(i);
+			remove_temporaries();
+		}
 		i = i->next;
 	}
+	while (num_units)
+		reap_unit();
+	if (unit_failed)
+		fatal();
 	if (last_phase < 4)
 		return;
 	link_phase();
@@ -863,6 +2240,24 @@ void extended_opt(const char *p)
 		crtname = "lib0.o";
 		return;
 	}
+	if (strncmp(p, "cache=", 6) == 0) {
+		cachedir = (char *)p + 6;
+		return;
+	}
+	if (strncmp(p, "cache-size=", 11) == 0) {
+		cachesize = strtoul(p + 11, NULL, 0);
+		return;
+	}
+	if (strcmp(p, "function-cache") == 0) {
+		func_cache = 1;
+		return;
+	}
+#ifdef COPT_SERVER
+	if (strncmp(p, "copt-server=", 12) == 0) {
+		copt_server = (char *)p + 12;
+		return;
+	}
+#endif
 	usage();
 }
 		
@@ -946,6 +2341,34 @@ int main(int argc, char *argv[]) {
 			} else
 				optimize = '1';
 			break;
+		case 'j':
+			if ((*p)[2])
+				jobs = atoi(*p + 2);
+			else if (p[1])
+				jobs = atoi(*++p);
+			else
+				usage();
+			if (jobs < 1 || jobs > MAXJOBS) {
+				fprintf(stderr, "cc: -j must be between 1 and %d.\n",
+					MAXJOBS);
+				fatal();
+			}
+			break;
+		case 'f':
+			if (strcmp(*p, "-fwhole-program") == 0)
+				whole_prog = 1;
+			else if (strcmp(*p, "-fintegrated-cpp") == 0)
+				int_cpp = 1;
+			else if (strncmp(*p, "-ftime-report=", 14) == 0)
+				time_file = *p + 14;
+			else
+				usage();
+			break;
+		case 'p':
+			if (strcmp(*p, "-pipe"))
+				usage();
+			pipe_mode = 1;
+			break;
 		case 's':	/* FIXME: for now - switch to getopt */
 			standalone = 1;
 			break;
@@ -961,10 +2384,27 @@ int main(int argc, char *argv[]) {
 			cpu = *p + 2;
 			break;	
 		case 'M':
-			mapfile = 1;
+			if ((*p)[2] == 0)
+				mapfile = 1;
+			else if (strcmp(*p, "-MD") == 0)
+				make_deps = 1;
+			else if (strcmp(*p, "-MP") == 0)
+				dep_phony = 1;
+			else if (strncmp(*p, "-MF", 3) == 0) {
+				make_deps = 1;
+				if ((*p)[3])
+					depfile = *p + 3;
+				else if (p[1])
+					depfile = *++p;
+				else
+					usage();
+			} else
+				usage();
 			break;
 		case 't':
-			if (strcmp(*p + 2, "fuzix") == 0) {
+			if (strcmp(*p + 2, "ime") == 0)
+				time_table = 1;
+			else if (strcmp(*p + 2, "fuzix") == 0) {
 				targetos = OS_FUZIX;
 				fuzixsub = 0;
 			}
@@ -999,11 +2439,23 @@ int main(int argc, char *argv[]) {
 		target = "a.out";
 	if (only_one_input && c_files > 1)
 		one_input();
+	if (depfile && c_files > 1) {
+		fprintf(stderr, "cc: -MF needs a single C source file.\n");
+		fatal();
+	}
+
+	if (cachedir && last_phase > 1)
+		cache_init();
+	if (func_cache && last_phase > 1)
+		function_cache_init();
+	if (time_table || time_file)
+		time_init();
 
-	symtab = xstrdup(".symtmp", 6);
-	snprintf(symtab + 7, 6, "%x", getpid());
+	make_symtab();
 	processing_loop();
 	unused_files();
 	unlink(symtab);
+	if (time_table || time_file)
+		time_report();
 	return 0;
 }
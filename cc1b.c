@@ -0,0 +1,1766 @@
+/*
+ *	cc1b: an optional pass between cc1 and cc2 that improves the
+ *	expression trees. cc1 folds each tree as it builds it, with only a
+ *	handful of nodes to play with, and never sees a whole function. We
+ *	copy the stream through, holding each function until its footer,
+ *	then work over all of it before writing it out in the same form.
+ *
+ *	- Constants assigned to locals are carried into later expressions
+ *	  until the flow of control joins a path where they may differ.
+ *	- Stores to locals that are never read, or are overwritten before
+ *	  anything reads them, are dropped.
+ *	- Constant expressions and identities are folded further than cc1
+ *	  can, and an if whose condition folds becomes a constant if so
+ *	  that cc2 can drop the dead branch.
+ *	- An expensive expression used more than once in a statement is
+ *	  worked out once into a temporary on the end of the stack frame.
+ *
+ *	Locals here are T_LOCAL, T_ARGUMENT and T_REG objects. We only touch
+ *	one if every use of it in the function is a plain read or assignment
+ *	of a single scalar type, and nothing takes the address of a local.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "compiler.h"
+
+static const char *argv0;
+
+void error(const char *p)
+{
+	fprintf(stderr, "%s: error: %s\n", argv0, p);
+	exit(1);
+}
+
+static void *xmalloc(unsigned size)
+{
+	void *p = malloc(size);
+	if (p == NULL)
+		error("out of memory");
+	return p;
+}
+
+static void *xrealloc(void *p, unsigned size)
+{
+	p = realloc(p, size);
+	if (p == NULL)
+		error("out of memory");
+	return p;
+}
+
+/*
+ *	Nodes. We hold a whole function so they come from the heap a table
+ *	at a time and are recycled through a free list.
+ */
+
+static struct node *nodes;
+
+void free_node(struct node *n)
+{
+	n->right = nodes;
+	nodes = n;
+}
+
+struct node *new_node(void)
+{
+	struct node *n;
+	unsigned i;
+
+	if (nodes == NULL) {
+		n = xmalloc(NUM_NODES * sizeof(struct node));
+		for (i = 0; i < NUM_NODES; i++)
+			free_node(n++);
+	}
+	n = nodes;
+	nodes = n->right;
+	memset(n, 0, sizeof(struct node));
+	return n;
+}
+
+void free_tree(struct node *n)
+{
+	if (n->left)
+		free_tree(n->left);
+	if (n->right)
+		free_tree(n->right);
+	free_node(n);
+}
+
+/*
+ *	Input and output. The stream is the one cc2 reads, see tree.h for
+ *	the packed nodes.
+ */
+
+static unsigned in_byte(void)
+{
+	int c = getchar();
+	if (c == EOF)
+		error("short read");
+	return c;
+}
+
+static void in_block(void *p, unsigned len)
+{
+	if (fread(p, len, 1, stdin) != 1)
+		error("short read");
+}
+
+static struct node *load_tree(void)
+{
+	uint8_t buf[NODE_MAX];
+	struct node *n = new_node();
+	unsigned shape;
+
+	in_block(buf, in_byte());
+	shape = unpack_node(n, buf);
+	if (shape & N_LEFT)
+		n->left = load_tree();
+	if (shape & N_RIGHT)
+		n->right = load_tree();
+	return n;
+}
+
+static void put_tree(struct node *n)
+{
+	uint8_t buf[NODE_MAX];
+
+	fwrite(buf, pack_node(n, buf), 1, stdout);
+	if (n->left)
+		put_tree(n->left);
+	if (n->right)
+		put_tree(n->right);
+}
+
+/*
+ *	Each record of the stream becomes a block. Outside of functions we
+ *	write them straight back out.
+ */
+
+struct block {
+	struct block *next;
+	unsigned kind;		/* '^' '[' or 'H' as in the stream */
+	unsigned role;		/* What a tree is there for */
+	unsigned dirty;		/* Tree has been changed */
+	struct header h;
+	struct node *n;
+	uint8_t *lit;		/* Literal bytes following an H_STRING */
+	unsigned litlen;
+};
+
+#define R_STMT		0	/* A statement on its own */
+#define R_COND		1	/* The condition of an if */
+#define R_RETURN	2	/* A return value */
+#define R_FIXED		3	/* Anything else a header is expecting */
+
+static void read_literal(struct block *b)
+{
+	unsigned size = 64;
+	unsigned c;
+
+	b->lit = xmalloc(size);
+	/* Up to and including the 0 marker, see process_literal() in cc2 */
+	do {
+		if (b->litlen == size) {
+			size *= 2;
+			b->lit = xrealloc(b->lit, size);
+		}
+		c = in_byte();
+		b->lit[b->litlen++] = c;
+	} while (c);
+}
+
+static struct block *read_block(unsigned kind)
+{
+	struct block *b = xmalloc(sizeof(struct block));
+
+	memset(b, 0, sizeof(struct block));
+	b->kind = kind;
+	if (kind == '^' || kind == '[')
+		b->n = load_tree();
+	else if (kind == 'H') {
+		in_block(&b->h, sizeof(struct header));
+		if (b->h.h_type == H_STRING)
+			read_literal(b);
+	} else
+		error("unknown block");
+	return b;
+}
+
+static void write_block(struct block *b)
+{
+	if (b->kind == 'H') {
+		fwrite("%H", 2, 1, stdout);
+		fwrite(&b->h, sizeof(struct header), 1, stdout);
+		if (b->lit)
+			fwrite(b->lit, b->litlen, 1, stdout);
+		return;
+	}
+	/* Statements we optimised away entirely */
+	if (b->n == NULL || (b->role == R_STMT && b->n->op == T_NULL))
+		return;
+	putchar('%');
+	putchar(b->kind);
+	put_tree(b->n);
+}
+
+static void free_block(struct block *b)
+{
+	if (b->n)
+		free_tree(b->n);
+	free(b->lit);
+	free(b);
+}
+
+/*
+ *	Tree helpers
+ */
+
+static unsigned changed;
+
+/* Every target has 2 byte int and pointers, and char, short and long of
+   1, 2 and 4 bytes. Allow 8 for a double so overlaps are caught */
+static unsigned scalar_size(unsigned t)
+{
+	if (PTR(t))
+		return 2;
+	if (!IS_SIMPLE(t) || t >= VOID)
+		return 0;
+	if (t >= FLOAT)
+		return t == FLOAT ? 4 : 8;
+	return 1 << ((t >> 4) & 3);
+}
+
+/* Types we can do constant arithmetic in */
+#define FOLDABLE(t)	(PTR(t) || (t) < CLONGLONG)
+
+static unsigned long type_mask(unsigned t)
+{
+	if (PTR(t))
+		return 0xFFFFUL;
+	switch (t & 0xF0) {
+	case CCHAR:
+		return 0xFFUL;
+	case CSHORT:
+		return 0xFFFFUL;
+	}
+	return 0xFFFFFFFFUL;
+}
+
+/* Put a value in the form cc1 uses for a constant of the type */
+static unsigned long trim(unsigned t, unsigned long v)
+{
+	unsigned long m = type_mask(t);
+
+	v &= m;
+	if (!PTR(t) && !(t & UNSIGNED) && (v & ~(m >> 1)))
+		v |= ~m;
+	return v;
+}
+
+static unsigned is_const(struct node *n)
+{
+	return n->op == T_CONSTANT && !(n->flags & LVAL) && FOLDABLE(n->type);
+}
+
+static unsigned is_slot(unsigned op)
+{
+	return op == T_LOCAL || op == T_ARGUMENT || op == T_REG;
+}
+
+static unsigned is_assign(unsigned op)
+{
+	switch (op) {
+	case T_EQ:
+	case T_PLUSEQ:
+	case T_MINUSEQ:
+	case T_STAREQ:
+	case T_SLASHEQ:
+	case T_PERCENTEQ:
+	case T_ANDEQ:
+	case T_OREQ:
+	case T_HATEQ:
+	case T_SHLEQ:
+	case T_SHREQ:
+	case T_PLUSPLUS:
+	case T_MINUSMINUS:
+		return 1;
+	}
+	return 0;
+}
+
+/* The sum a compound assignment does */
+static unsigned assign_op(unsigned op)
+{
+	switch (op) {
+	case T_PLUSEQ:
+	case T_PLUSPLUS:
+		return T_PLUS;
+	case T_MINUSEQ:
+	case T_MINUSMINUS:
+		return T_MINUS;
+	case T_STAREQ:
+		return T_STAR;
+	case T_SLASHEQ:
+		return T_SLASH;
+	case T_PERCENTEQ:
+		return T_PERCENT;
+	case T_ANDEQ:
+		return T_AND;
+	case T_OREQ:
+		return T_OR;
+	case T_HATEQ:
+		return T_HAT;
+	case T_SHLEQ:
+		return T_LTLT;
+	case T_SHREQ:
+		return T_GTGT;
+	}
+	return 0;
+}
+
+/* We work this out rather than trust IMPURE as we change trees */
+static unsigned side_effects(struct node *n)
+{
+	if (n == NULL)
+		return 0;
+	if ((n->flags & SIDEEFFECT) || is_assign(n->op) || n->op == T_FUNCCALL)
+		return 1;
+	return side_effects(n->left) || side_effects(n->right);
+}
+
+static unsigned tree_equal(struct node *a, struct node *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return a->op == b->op && a->type == b->type && a->value == b->value &&
+		a->snum == b->snum && a->val2 == b->val2 &&
+		!((a->flags ^ b->flags) & LVAL) &&
+		tree_equal(a->left, b->left) && tree_equal(a->right, b->right);
+}
+
+/*
+ *	Folding
+ */
+
+/* Turn n into a constant of its own type */
+static struct node *constant(struct node *n, unsigned long v)
+{
+	if (n->left)
+		free_tree(n->left);
+	if (n->right)
+		free_tree(n->right);
+	n->left = NULL;
+	n->right = NULL;
+	n->op = T_CONSTANT;
+	n->value = trim(n->type, v);
+	n->snum = 0;
+	n->val2 = 0;
+	n->flags &= ~(SIDEEFFECT | IMPURE);
+	changed = 1;
+	return n;
+}
+
+/* Replace n with its child c, dropping the other side */
+static struct node *take(struct node *n, struct node *c)
+{
+	c->flags |= n->flags & (NORETURN | CCONLY);
+	if (n->left && n->left != c)
+		free_tree(n->left);
+	if (n->right && n->right != c)
+		free_tree(n->right);
+	free_node(n);
+	changed = 1;
+	return c;
+}
+
+/* As take() but only if c is the same kind of value as n */
+static struct node *same(struct node *n, struct node *c)
+{
+	if (c->type != n->type || ((c->flags ^ n->flags) & LVAL))
+		return n;
+	return take(n, c);
+}
+
+/* The truth of a constant, allowing for a T_BOOL around it, or -1 */
+static int truth(struct node *n)
+{
+	if (n->op == T_BOOL)
+		n = n->right;
+	if (is_const(n))
+		return trim(n->type, n->value) != 0;
+	return -1;
+}
+
+/* Can stand in for the value of a && or || */
+static unsigned is_truth(struct node *c, struct node *n)
+{
+	return (c->op == T_BOOL || is_const(c)) && c->type == n->type;
+}
+
+static unsigned fold_value(unsigned op, unsigned t, unsigned long a,
+			   unsigned long b, unsigned long *vp)
+{
+	unsigned u = PTR(t) || (t & UNSIGNED);
+	unsigned bits = 8 * scalar_size(t);
+	unsigned long v;
+
+	switch (op) {
+	case T_PLUS:
+		v = a + b;
+		break;
+	case T_MINUS:
+		v = a - b;
+		break;
+	case T_STAR:
+		v = a * b;
+		break;
+	case T_SLASH:
+		/* Leave division by zero for run time */
+		if (b == 0)
+			return 0;
+		v = u ? a / b : (unsigned long)((signed long)a / (signed long)b);
+		break;
+	case T_PERCENT:
+		if (b == 0)
+			return 0;
+		v = u ? a % b : (unsigned long)((signed long)a % (signed long)b);
+		break;
+	case T_AND:
+		v = a & b;
+		break;
+	case T_OR:
+		v = a | b;
+		break;
+	case T_HAT:
+		v = a ^ b;
+		break;
+	case T_LTLT:
+		if (b >= bits)
+			return 0;
+		v = a << b;
+		break;
+	case T_GTGT:
+		if (b >= bits)
+			return 0;
+		v = u ? a >> b : (unsigned long)((signed long)a >> b);
+		break;
+	case T_EQEQ:
+		v = a == b;
+		break;
+	case T_BANGEQ:
+		v = a != b;
+		break;
+	case T_LT:
+		v = u ? a < b : (signed long)a < (signed long)b;
+		break;
+	case T_GT:
+		v = u ? a > b : (signed long)a > (signed long)b;
+		break;
+	case T_LTEQ:
+		v = u ? a <= b : (signed long)a <= (signed long)b;
+		break;
+	case T_GTEQ:
+		v = u ? a >= b : (signed long)a >= (signed long)b;
+		break;
+	default:
+		return 0;
+	}
+	*vp = v;
+	return 1;
+}
+
+static struct node *fold_logic(struct node *n)
+{
+	struct node *l = n->left;
+	struct node *r = n->right;
+	unsigned oror = n->op == T_OROR;
+	int t;
+
+	t = truth(l);
+	if (t != -1) {
+		/* A false && or true || never looks at the right */
+		if (t == oror)
+			return constant(n, t);
+		if (is_truth(r, n))
+			return take(n, r);
+		return n;
+	}
+	t = truth(r);
+	if (t != -1) {
+		if (t != oror && is_truth(l, n))
+			return take(n, l);
+		if (t == oror && !side_effects(l))
+			return constant(n, t);
+	}
+	return n;
+}
+
+static struct node *fold_question(struct node *n)
+{
+	struct node *r = n->right;
+	struct node *c;
+	int t = truth(n->left);
+
+	if (t == -1 || r->op != T_COLON)
+		return n;
+	c = t ? r->left : r->right;
+	if (c->type != n->type || (c->flags & LVAL))
+		return n;
+	if (t)
+		r->left = NULL;
+	else
+		r->right = NULL;
+	free_tree(r);
+	n->right = c;
+	return take(n, c);
+}
+
+static struct node *fold_unary(struct node *n)
+{
+	struct node *r = n->right;
+	struct node *c;
+	unsigned long v;
+
+	if (is_const(r) && FOLDABLE(n->type) && !(n->flags & LVAL)) {
+		v = trim(r->type, r->value);
+		switch (n->op) {
+		case T_NEGATE:
+			return constant(n, -v);
+		case T_TILDE:
+			return constant(n, ~v);
+		case T_BANG:
+			return constant(n, !v);
+		case T_BOOL:
+			/* cc2 wants the condition codes from this one */
+			if (n->flags & NEEDCC)
+				return n;
+			return constant(n, v != 0);
+		case T_CAST:
+			return constant(n, v);
+		}
+		return n;
+	}
+	switch (n->op) {
+	case T_NEGATE:
+	case T_TILDE:
+		/* - - x and ~ ~ x */
+		if (r->op == n->op && FOLDABLE(n->type) &&
+		    r->right->type == n->type) {
+			c = r->right;
+			r->right = NULL;
+			return take(n, c);
+		}
+		break;
+	case T_CAST:
+		return same(n, r);
+	}
+	return n;
+}
+
+/* (x + c1) - c2 and friends */
+static struct node *fold_offset(struct node *n)
+{
+	struct node *l = n->left;
+	struct node *r = n->right;
+	struct node *c = l->right;
+	unsigned long a = trim(c->type, c->value);
+	unsigned long b = trim(r->type, r->value);
+	unsigned long v, nv;
+
+	if (l->type != n->type || c->type != r->type || (l->flags & LVAL))
+		return n;
+	v = (l->op == T_PLUS ? a : -a) + (n->op == T_PLUS ? b : -b);
+	v = trim(r->type, v);
+	nv = trim(r->type, -v);
+	/* Keep the constant small, so x - 2 not x + 0xFFFE */
+	if (nv < v) {
+		l->op = T_MINUS;
+		c->value = nv;
+	} else {
+		l->op = T_PLUS;
+		c->value = v;
+	}
+	return take(n, l);
+}
+
+static struct node *fold_node(struct node *n)
+{
+	struct node *l = n->left;
+	struct node *r = n->right;
+	unsigned long v, m;
+
+	if (n->op == T_ANDAND || n->op == T_OROR)
+		return fold_logic(n);
+	if (n->op == T_QUESTION)
+		return fold_question(n);
+	if (r && l == NULL)
+		return fold_unary(n);
+	if (l == NULL || r == NULL)
+		return n;
+
+	if (n->flags & LVAL) {
+		/* Offset from a constant address, as cc1 does for names */
+		if (n->op == T_PLUS && l->op == T_CONSTANT && (l->flags & LVAL) &&
+		    is_const(r)) {
+			l->value = trim(PTRTO, l->value + trim(r->type, r->value));
+			l->type = n->type;
+			return take(n, l);
+		}
+		return n;
+	}
+	if (!FOLDABLE(n->type) || !FOLDABLE(l->type) || !FOLDABLE(r->type))
+		return n;
+
+	if (is_const(l) && is_const(r)) {
+		if (fold_value(n->op, l->type, trim(l->type, l->value),
+			       trim(r->type, r->value), &v))
+			return constant(n, v);
+		return n;
+	}
+
+	m = type_mask(n->type);
+	if (is_const(r)) {
+		v = trim(r->type, r->value);
+		switch (n->op) {
+		case T_PLUS:
+		case T_MINUS:
+			if (v == 0)
+				return same(n, l);
+			if (l->op == T_PLUS || l->op == T_MINUS) {
+				if (is_const(l->right))
+					return fold_offset(n);
+			}
+			break;
+		case T_OR:
+			if ((v & m) == m && !side_effects(l))
+				return constant(n, v);
+			/* Fall through */
+		case T_HAT:
+		case T_LTLT:
+		case T_GTGT:
+			if (v == 0)
+				return same(n, l);
+			break;
+		case T_STAR:
+			if (v == 0 && !side_effects(l))
+				return constant(n, 0);
+			/* Fall through */
+		case T_SLASH:
+			if (v == 1)
+				return same(n, l);
+			break;
+		case T_PERCENT:
+			if (v == 1 && !side_effects(l))
+				return constant(n, 0);
+			break;
+		case T_AND:
+			if (v == 0 && !side_effects(l))
+				return constant(n, 0);
+			if ((v & m) == m)
+				return same(n, l);
+			break;
+		}
+	}
+	if (is_const(l)) {
+		v = trim(l->type, l->value);
+		switch (n->op) {
+		case T_OR:
+			if ((v & m) == m && !side_effects(r))
+				return constant(n, v);
+			/* Fall through */
+		case T_PLUS:
+		case T_HAT:
+			if (v == 0)
+				return same(n, r);
+			break;
+		case T_STAR:
+			if (v == 0 && !side_effects(r))
+				return constant(n, 0);
+			if (v == 1)
+				return same(n, r);
+			break;
+		case T_AND:
+			if (v == 0 && !side_effects(r))
+				return constant(n, 0);
+			if ((v & m) == m)
+				return same(n, r);
+			break;
+		}
+	}
+	/* The same value on both sides */
+	if (tree_equal(l, r) && !side_effects(l)) {
+		switch (n->op) {
+		case T_MINUS:
+		case T_HAT:
+		case T_BANGEQ:
+		case T_LT:
+		case T_GT:
+			return constant(n, 0);
+		case T_EQEQ:
+		case T_LTEQ:
+		case T_GTEQ:
+			return constant(n, 1);
+		case T_AND:
+		case T_OR:
+			return same(n, l);
+		}
+	}
+	return n;
+}
+
+static void fold(struct node **np)
+{
+	struct node *n = *np;
+	struct node *m;
+
+	if (n->left)
+		fold(&n->left);
+	if (n->right)
+		fold(&n->right);
+	while ((m = fold_node(n)) != n)
+		n = m;
+	*np = n;
+}
+
+/*
+ *	Locals
+ */
+
+struct slot {
+	unsigned op;
+	unsigned long offset;
+	unsigned type;
+	unsigned size;
+	unsigned bad;		/* Leave it alone */
+	unsigned reads;
+	unsigned mark;		/* Written by the tree in hand */
+	struct node **store;	/* Last store nobody has read yet */
+	struct block *store_blk;
+};
+
+struct fact {
+	unsigned known;
+	unsigned long value;
+};
+
+static struct slot *slots;
+static struct fact *facts;
+static unsigned nslot;
+static unsigned maxslot;
+static unsigned escaped;
+static struct block *frame_blk;
+static unsigned dead;		/* Nothing can get to here */
+static unsigned gen;
+
+static struct slot *find_slot(struct node *n)
+{
+	struct slot *s = slots;
+	unsigned i;
+
+	for (i = 0; i < nslot; i++, s++)
+		if (s->op == n->op && s->offset == n->value)
+			return s;
+	return NULL;
+}
+
+static struct slot *good_slot(struct node *n)
+{
+	struct slot *s = find_slot(n);
+	if (s && !s->bad)
+		return s;
+	return NULL;
+}
+
+static struct slot *add_slot(struct node *n)
+{
+	struct slot *s = find_slot(n);
+	unsigned size = scalar_size(n->type);
+
+	if (s == NULL) {
+		if (nslot == maxslot) {
+			maxslot = maxslot ? 2 * maxslot : 32;
+			slots = xrealloc(slots, maxslot * sizeof(struct slot));
+			facts = xrealloc(facts, maxslot * sizeof(struct fact));
+		}
+		s = slots + nslot++;
+		memset(s, 0, sizeof(struct slot));
+		s->op = n->op;
+		s->offset = n->value;
+		s->type = n->type;
+		s->size = size;
+	} else if (s->type != n->type) {
+		/* A union or a reused offset */
+		s->bad = 1;
+		if (size > s->size)
+			s->size = size;
+	}
+	return s;
+}
+
+/* Someone wants the address of a local, so any pointer might be one */
+static void escape(struct slot *s)
+{
+	if (s->op == T_REG)
+		s->bad = 1;
+	else
+		escaped = 1;
+}
+
+static void scan_slots(struct node *n, struct node *up)
+{
+	struct slot *s;
+
+	if (is_slot(n->op)) {
+		s = add_slot(n);
+		if (s->size == 0)
+			escape(s);
+		else if (up && up->op == T_DEREF && up->right == n) {
+			/* Volatile */
+			if (up->flags & SIDEEFFECT)
+				s->bad = 1;
+		} else if (up == NULL || !is_assign(up->op) || up->left != n ||
+			   !(n->flags & LVAL))
+			escape(s);
+	}
+	if (n->left)
+		scan_slots(n->left, n);
+	if (n->right)
+		scan_slots(n->right, n);
+}
+
+static void check_slots(void)
+{
+	struct slot *s, *t;
+	unsigned i, j;
+
+	for (i = 0, s = slots; i < nslot; i++, s++) {
+		if (frame_blk && (frame_blk->h.h_data & F_VOLATILE)) {
+			s->bad = 1;
+			continue;
+		}
+		if (s->op == T_REG)
+			continue;
+		if (escaped) {
+			s->bad = 1;
+			continue;
+		}
+		/* Anything that overlaps something else at another offset */
+		for (j = i + 1, t = s + 1; j < nslot; j++, t++) {
+			if (t->op == s->op && s->offset < t->offset + t->size &&
+			    t->offset < s->offset + s->size) {
+				s->bad = 1;
+				t->bad = 1;
+			}
+		}
+	}
+}
+
+static void mark_writes(struct node *n)
+{
+	struct slot *s;
+
+	if (is_assign(n->op) && is_slot(n->left->op)) {
+		s = find_slot(n->left);
+		if (s)
+			s->mark = gen;
+	}
+	if (n->left)
+		mark_writes(n->left);
+	if (n->right)
+		mark_writes(n->right);
+}
+
+/* Replace reads of locals we know the value of */
+static void subst(struct node **np)
+{
+	struct node *n = *np;
+	struct slot *s;
+	struct fact *f;
+
+	if (n->op == T_DEREF && is_slot(n->right->op)) {
+		s = good_slot(n->right);
+		if (s == NULL || s->mark == gen)
+			return;
+		f = facts + (s - slots);
+		if (f->known) {
+			/* Keeps the type and LVAL of the read, so *p with p
+			   known becomes a constant address like *(int *)4 */
+			free_node(n->right);
+			n->right = NULL;
+			n->op = T_CONSTANT;
+			n->value = f->value;
+			changed = 1;
+		}
+		return;
+	}
+	if (n->left)
+		subst(&n->left);
+	if (n->right)
+		subst(&n->right);
+}
+
+/* Reads keep the store before alive, and writes lose what we knew */
+static void note_uses(struct node *n)
+{
+	struct slot *s;
+
+	if (n->op == T_DEREF && is_slot(n->right->op)) {
+		s = find_slot(n->right);
+		if (s)
+			s->store = NULL;
+		return;
+	}
+	if (is_assign(n->op) && is_slot(n->left->op)) {
+		s = find_slot(n->left);
+		if (s) {
+			facts[s - slots].known = 0;
+			if (n->op != T_EQ)
+				s->store = NULL;
+		}
+	}
+	if (n->left)
+		note_uses(n->left);
+	if (n->right)
+		note_uses(n->right);
+}
+
+static void count_reads(struct node *n)
+{
+	struct slot *s;
+
+	if ((n->op == T_DEREF && is_slot(n->right->op)) ||
+	    (is_assign(n->op) && n->op != T_EQ && is_slot(n->left->op))) {
+		s = find_slot(n->op == T_DEREF ? n->right : n->left);
+		if (s)
+			s->reads++;
+	}
+	if (n->left)
+		count_reads(n->left);
+	if (n->right)
+		count_reads(n->right);
+}
+
+/* Remove an assignment to a local, keeping anything else it does */
+static void kill_store(struct node **np)
+{
+	struct node *n = *np;
+	struct node *r = n->right;
+	struct node *c;
+
+	free_tree(n->left);
+	free_node(n);
+	if (side_effects(r)) {
+		while (r->op == T_CAST) {
+			c = r;
+			r = r->right;
+			free_node(c);
+		}
+		r->flags |= NORETURN;
+	} else {
+		free_tree(r);
+		r = new_node();
+		r->op = T_NULL;
+		r->type = VOID;
+		r->flags = NORETURN;
+	}
+	*np = r;
+	changed = 1;
+}
+
+static void clear_stores(void)
+{
+	unsigned i;
+	for (i = 0; i < nslot; i++)
+		slots[i].store = NULL;
+}
+
+static void clear_facts(void)
+{
+	memset(facts, 0, nslot * sizeof(struct fact));
+	clear_stores();
+}
+
+static struct fact *copy_facts(void)
+{
+	struct fact *f = xmalloc(nslot * sizeof(struct fact) + 1);
+	memcpy(f, facts, nslot * sizeof(struct fact));
+	return f;
+}
+
+/* Only what held on both paths holds where they meet, unless one of
+   them jumped away */
+static void join_facts(struct fact *f, unsigned fdead)
+{
+	struct fact *c = facts;
+	unsigned i;
+
+	if (fdead)
+		return;
+	if (dead) {
+		memcpy(facts, f, nslot * sizeof(struct fact));
+		dead = 0;
+		return;
+	}
+	for (i = 0; i < nslot; i++, c++, f++)
+		if (!f->known || f->value != c->value)
+			c->known = 0;
+}
+
+/* A tree that is not part of a comma at the top */
+static void flow_unit(struct block *b, struct node **np, unsigned discard)
+{
+	struct node *n = *np;
+	struct slot *s = NULL;
+	struct fact *f;
+	unsigned long v;
+
+	/* The store at the top happens after the rest is worked out so
+	   the right hand side still sees the old value */
+	gen++;
+	if (is_assign(n->op) && is_slot(n->left->op)) {
+		s = good_slot(n->left);
+		mark_writes(n->right);
+	} else
+		mark_writes(n);
+	subst(np);
+	fold(np);
+	n = *np;
+
+	if (s) {
+		f = facts + (s - slots);
+		/* x += 2 with x known is just an assignment */
+		if (n->op != T_EQ && discard && f->known &&
+		    is_const(n->right) && FOLDABLE(s->type) &&
+		    fold_value(assign_op(n->op), s->type, f->value,
+			       trim(n->right->type, n->right->value), &v)) {
+			n->op = T_EQ;
+			n->right->value = trim(s->type, v);
+			n->right->type = s->type;
+			changed = 1;
+		}
+	}
+	note_uses(n);
+	if (s && n->op == T_EQ) {
+		f = facts + (s - slots);
+		if (is_const(n->right) && n->right->type == s->type) {
+			f->known = 1;
+			f->value = trim(s->type, n->right->value);
+		}
+		if (discard) {
+			/* Nothing read the last one */
+			if (s->store) {
+				kill_store(s->store);
+				s->store_blk->dirty = 1;
+			}
+			s->store = np;
+			s->store_blk = b;
+		} else
+			s->store = NULL;
+	}
+}
+
+static void flow_tree(struct block *b, struct node **np, unsigned discard)
+{
+	struct node *n = *np;
+
+	discard |= n->flags & NORETURN;
+	if (n->op == T_COMMA) {
+		flow_tree(b, &n->left, 1);
+		flow_tree(b, &n->right, discard);
+		return;
+	}
+	flow_unit(b, np, discard);
+}
+
+/* Drop stores to locals nobody ever reads */
+static void dead_stores(struct block *b, struct node **np, unsigned discard)
+{
+	struct node *n = *np;
+	struct slot *s;
+
+	discard |= n->flags & NORETURN;
+	if (n->op == T_COMMA) {
+		dead_stores(b, &n->left, 1);
+		dead_stores(b, &n->right, discard);
+		return;
+	}
+	if (discard && n->op == T_EQ && is_slot(n->left->op)) {
+		s = good_slot(n->left);
+		if (s && s->reads == 0) {
+			kill_store(np);
+			b->dirty = 1;
+		}
+	}
+}
+
+/*
+ *	Common subexpressions within a statement. We only do this where
+ *	nothing but the top of the tree has a side effect, so it does not
+ *	matter when the expression is worked out. The value goes in a
+ *	temporary on the end of the frame, and loading that costs about as
+ *	much as a couple of simple nodes so it has to be worth it.
+ */
+
+#define MAX_CAND	64
+#define MAX_TEMP	8
+#define CSE_STORE	4
+#define CSE_LOAD	4
+#define CSE_FRAME	8	/* Setting up a frame where there was none */
+
+struct cand {
+	struct node **link;
+	unsigned cond;		/* Only worked out on some paths */
+	unsigned weight;
+	unsigned group;
+};
+
+static struct cand cand[MAX_CAND];
+static unsigned ncand;
+
+static struct temp {
+	unsigned offset;
+	unsigned size;
+	unsigned used;
+} temps[MAX_TEMP];
+static unsigned ntemp;
+
+/* Rough cost of a pure subtree, or 0 if it is not one we can handle */
+static unsigned cse_weight(struct node *n)
+{
+	unsigned w, l = 0, r = 0;
+
+	if (!(n->flags & LVAL) && !FOLDABLE(n->type))
+		return 0;
+	if (n->flags & SIDEEFFECT)
+		return 0;
+	switch (n->op) {
+	case T_CONSTANT:
+	case T_NAME:
+	case T_LABEL:
+	case T_LOCAL:
+	case T_ARGUMENT:
+	case T_REG:
+		return 1;
+	case T_STAR:
+	case T_SLASH:
+	case T_PERCENT:
+		w = 8;
+		break;
+	case T_LTLT:
+	case T_GTGT:
+		w = 4;
+		break;
+	case T_DEREF:
+		w = 3;
+		break;
+	case T_PLUS:
+	case T_MINUS:
+	case T_AND:
+	case T_OR:
+	case T_HAT:
+	case T_NEGATE:
+	case T_TILDE:
+	case T_CAST:
+		w = 2;
+		break;
+	default:
+		return 0;
+	}
+	if (n->left && (l = cse_weight(n->left)) == 0)
+		return 0;
+	if (n->right && (r = cse_weight(n->right)) == 0)
+		return 0;
+	/* Long maths is a lot of work on all our targets */
+	if (!PTR(n->type) && (n->type & 0xF0) == CLONG)
+		w *= 2;
+	return w + l + r;
+}
+
+static void cse_collect(struct node **np, unsigned cond)
+{
+	struct node *n = *np;
+	unsigned w;
+
+	if ((n->left || n->right) && !(n->flags & (LVAL | CCONLY | NEEDCC)) &&
+	    ncand < MAX_CAND) {
+		w = cse_weight(n);
+		if (w && !(n->op == T_DEREF && is_slot(n->right->op))) {
+			cand[ncand].link = np;
+			cand[ncand].cond = cond;
+			cand[ncand].weight = w;
+			ncand++;
+		}
+	}
+	switch (n->op) {
+	case T_ANDAND:
+	case T_OROR:
+	case T_QUESTION:
+		cse_collect(&n->left, cond);
+		cse_collect(&n->right, 1);
+		return;
+	case T_COLON:
+		cond = 1;
+		break;
+	}
+	if (n->left)
+		cse_collect(&n->left, cond);
+	if (n->right)
+		cse_collect(&n->right, cond);
+}
+
+static struct node *temp_node(struct temp *t, unsigned type, unsigned read)
+{
+	struct node *n = new_node();
+	struct node *d;
+
+	n->op = T_LOCAL;
+	n->value = t->offset;
+	n->type = type;
+	n->flags = LVAL;
+	if (read == 0)
+		return n;
+	d = new_node();
+	d->op = T_DEREF;
+	d->type = type;
+	d->right = n;
+	return d;
+}
+
+/* Temporaries are only live within a tree so get reused */
+static struct temp *get_temp(unsigned size)
+{
+	struct temp *t = temps;
+	unsigned frame;
+	unsigned i;
+
+	for (i = 0; i < ntemp; i++, t++) {
+		if (t->size == size && !t->used) {
+			t->used = 1;
+			return t;
+		}
+	}
+	frame = frame_blk->h.h_name;
+	if (size > 1)
+		frame = (frame + 1) & ~1;
+	/* Keep the frame in reach of short offsets */
+	if (ntemp == MAX_TEMP || frame + size > 255)
+		return NULL;
+	t->offset = frame;
+	t->size = size;
+	t->used = 1;
+	frame_blk->h.h_name = frame + size;
+	ntemp++;
+	return t;
+}
+
+static void cse_unit(struct node **np)
+{
+	struct cand *c, *d;
+	struct node *n, *e;
+	struct temp *t;
+	unsigned i, j, count, uncond, cost, gain, best, bgain;
+	unsigned tries;
+
+	for (i = 0; i < ntemp; i++)
+		temps[i].used = 0;
+	for (tries = 0; tries < 2; tries++) {
+		n = *np;
+		if (side_effects(n->left) || side_effects(n->right))
+			return;
+		ncand = 0;
+		cse_collect(np, 0);
+		for (i = 0; i < ncand; i++)
+			cand[i].group = i;
+		best = ncand;
+		bgain = 0;
+		for (i = 0, c = cand; i < ncand; i++, c++) {
+			if (c->group != i)
+				continue;
+			count = 1;
+			uncond = !c->cond;
+			for (j = i + 1, d = c + 1; j < ncand; j++, d++) {
+				if (d->group == j && tree_equal(*c->link, *d->link)) {
+					d->group = i;
+					count++;
+					uncond |= !d->cond;
+				}
+			}
+			/* It must be worked out anyway for us to do it first */
+			if (count < 2 || !uncond)
+				continue;
+			gain = c->weight * (count - 1);
+			cost = CSE_STORE + CSE_LOAD * count;
+			if (frame_blk->h.h_name == 0)
+				cost += CSE_FRAME;
+			if (gain <= cost)
+				continue;
+			gain -= cost;
+			if (gain > bgain) {
+				best = i;
+				bgain = gain;
+			}
+		}
+		if (best == ncand)
+			return;
+		e = *cand[best].link;
+		t = get_temp(scalar_size(e->type));
+		if (t == NULL)
+			return;
+		for (i = best, c = cand + best; i < ncand; i++, c++) {
+			if (c->group != best)
+				continue;
+			if (i != best)
+				free_tree(*c->link);
+			*c->link = temp_node(t, e->type, 1);
+		}
+		n = new_node();
+		n->op = T_EQ;
+		n->left = temp_node(t, e->type, 0);
+		n->right = e;
+		n->type = e->type;
+		n->flags = SIDEEFFECT | NORETURN;
+		e = new_node();
+		e->op = T_COMMA;
+		e->left = n;
+		e->right = *np;
+		e->type = e->right->type;
+		e->flags = e->right->flags & (NORETURN | SIDEEFFECT);
+		*np = e;
+		np = &e->right;
+		changed = 1;
+	}
+}
+
+static void cse_tree(struct node **np)
+{
+	struct node *n = *np;
+
+	if (n->op == T_COMMA) {
+		cse_tree(&n->left);
+		cse_tree(&n->right);
+	} else
+		cse_unit(np);
+}
+
+/* Clean up after kill_store() and put IMPURE back as cc1 would */
+static struct node *tidy(struct node *n)
+{
+	struct node *c = NULL;
+
+	if (n->left)
+		n->left = tidy(n->left);
+	if (n->right)
+		n->right = tidy(n->right);
+	if (n->op == T_COMMA) {
+		if (n->left->op == T_NULL) {
+			c = n->right;
+			free_node(n->left);
+		} else if (n->right->op == T_NULL && (n->flags & NORETURN)) {
+			c = n->left;
+			free_node(n->right);
+		}
+		if (c) {
+			c->flags |= n->flags & (NORETURN | SIDEEFFECT | CCONLY);
+			free_node(n);
+			n = c;
+		}
+	}
+	n->flags &= ~IMPURE;
+	if ((n->left && (n->left->flags & (SIDEEFFECT | IMPURE))) ||
+	    (n->right && (n->right->flags & (SIDEEFFECT | IMPURE))))
+		n->flags |= IMPURE;
+	return n;
+}
+
+/*
+ *	The flow of control. We follow the headers cc1 writes for each
+ *	statement, tracking what we know about locals through straight
+ *	line code and across an if. Anything else that jumps or is jumped
+ *	to makes us forget it all.
+ */
+
+struct ifstate {
+	struct fact *before;	/* At the start of each branch */
+	struct fact *then;	/* At the end of the first */
+	unsigned before_dead;
+	unsigned then_dead;
+	unsigned truth;
+};
+
+static struct ifstate *ifs;
+static unsigned nif;
+static unsigned maxif;
+
+static struct block *cond_hdr;
+
+static void if_enter(unsigned truth)
+{
+	struct ifstate *i;
+
+	if (nif == maxif) {
+		maxif = maxif ? 2 * maxif : 16;
+		ifs = xrealloc(ifs, maxif * sizeof(struct ifstate));
+	}
+	i = ifs + nif++;
+	i->before = copy_facts();
+	i->then = NULL;
+	/* A constant if has only one way in, see H_IF in cc2 */
+	i->before_dead = dead || truth == 1;
+	i->truth = truth;
+	if (truth == 0)
+		dead = 1;
+	clear_stores();
+}
+
+static void walk_header(struct block *b)
+{
+	struct ifstate *i;
+
+	switch (b->h.h_type) {
+	/* Nothing to do with the flow of the code */
+	case H_FRAME:
+	case H_STRING:
+	case H_STRING | H_FOOTER:
+	case H_DATA:
+	case H_DATA | H_FOOTER:
+	case H_BSS:
+	case H_BSS | H_FOOTER:
+	case H_ARGFRAME:
+	case H_EXPORT:
+	case H_SWITCHTAB:
+	case H_SWITCHTAB | H_FOOTER:
+		return;
+	case H_IF:
+		if (b->h.h_data == -1)
+			cond_hdr = b;
+		else
+			if_enter(b->h.h_data);
+		return;
+	case H_ELSE:
+		i = ifs + nif - 1;
+		/* The else has the truth of the if so cc2 knows about _e */
+		if (i->truth != -1)
+			b->h.h_data = i->truth;
+		i->then = copy_facts();
+		i->then_dead = dead;
+		memcpy(facts, i->before, nslot * sizeof(struct fact));
+		dead = i->before_dead;
+		clear_stores();
+		return;
+	case H_IF | H_FOOTER:
+		i = ifs + --nif;
+		if (i->then)
+			join_facts(i->then, i->then_dead);
+		else
+			join_facts(i->before, i->before_dead);
+		free(i->before);
+		free(i->then);
+		clear_stores();
+		return;
+	/* The cases will forget everything for a switch */
+	case H_RETURN:
+	case H_SWITCH:
+		return;
+	case H_RETURN | H_FOOTER:
+	case H_BREAK:
+	case H_CONTINUE:
+	case H_GOTO:
+		clear_facts();
+		dead = 1;
+		return;
+	}
+	/* Anything else may be jumped to */
+	clear_facts();
+	dead = 0;
+}
+
+static void walk_tree(struct block *b)
+{
+	int t;
+
+	flow_tree(b, &b->n, 0);
+	switch (b->role) {
+	case R_RETURN:
+		b->n->flags |= SIDEEFFECT;
+		break;
+	case R_COND:
+		t = truth(b->n);
+		if (t != -1) {
+			cond_hdr->h.h_data = t;
+			free_tree(b->n);
+			b->n = NULL;
+		}
+		if_enter(t);
+		break;
+	case R_FIXED:
+		/* Loop conditions and for clauses are each reached from
+		   somewhere else */
+		clear_facts();
+		break;
+	}
+}
+
+/*
+ *	An if with a constant condition only needs the code for one side.
+ *	cc2 keeps the other in case something jumps into the middle of it,
+ *	but we can see the whole function and drop it if nothing can.
+ */
+
+static unsigned unreachable(struct block *b)
+{
+	if (b->kind == '^')
+		return 1;
+	if (b->kind != 'H')
+		return 0;
+	switch (b->h.h_type & ~H_FOOTER) {
+	case H_STRING:
+		/* Anonymous literals only */
+		return (b->h.h_type & H_FOOTER) || b->h.h_data;
+	case H_IF:
+	case H_ELSE:
+	case H_WHILE:
+	case H_DO:
+	case H_DOWHILE:
+	case H_FOR:
+	case H_RETURN:
+	case H_BREAK:
+	case H_CONTINUE:
+	case H_GOTO:
+		return 1;
+	}
+	return 0;
+}
+
+/* From b up to but not including e */
+static unsigned can_drop(struct block *b, struct block *e)
+{
+	for (; b != e; b = b->next)
+		if (!unreachable(b))
+			return 0;
+	return 1;
+}
+
+/* Remove *bp through last */
+static void drop(struct block **bp, struct block *last)
+{
+	struct block *b = *bp;
+	struct block *n;
+
+	*bp = last->next;
+	last->next = NULL;
+	while (b) {
+		n = b->next;
+		free_block(b);
+		b = n;
+	}
+}
+
+static void prune(struct block *func)
+{
+	struct block **bp = &func->next;
+	struct block **pe, **pf, **pp;
+	struct block *b;
+
+	while ((b = *bp) != NULL) {
+		if (b->kind != 'H' || b->h.h_type != H_IF || b->h.h_data > 1) {
+			bp = &b->next;
+			continue;
+		}
+		pe = NULL;
+		pf = NULL;
+		for (pp = &b->next; *pp; pp = &(*pp)->next) {
+			if ((*pp)->kind != 'H' || (*pp)->h.h_name != b->h.h_name)
+				continue;
+			if ((*pp)->h.h_type == H_ELSE)
+				pe = pp;
+			if ((*pp)->h.h_type == (H_IF | H_FOOTER)) {
+				pf = pp;
+				break;
+			}
+		}
+		if (pf == NULL)
+			error("if mismatch");
+		if (b->h.h_data == 0) {
+			if (!can_drop(b->next, pe ? *pe : *pf)) {
+				bp = &b->next;
+				continue;
+			}
+			/* Keep any else part */
+			if (pe) {
+				drop(pf, *pf);
+				drop(bp, *pe);
+			} else
+				drop(bp, *pf);
+		} else {
+			if (pe && !can_drop(*pe, *pf)) {
+				bp = &b->next;
+				continue;
+			}
+			drop(pe ? pe : pf, *pf);
+			drop(bp, b);
+		}
+	}
+}
+
+/* Work out what each tree is for from the header before it */
+static void set_roles(struct block *func)
+{
+	struct block *b;
+	unsigned expect = 0;
+	unsigned role = R_STMT;
+
+	for (b = func; b; b = b->next) {
+		if (b->kind == '^') {
+			b->role = R_STMT;
+			if (expect) {
+				b->role = role;
+				expect--;
+			}
+			continue;
+		}
+		if (b->kind != 'H')
+			continue;
+		switch (b->h.h_type) {
+		case H_FRAME:
+			frame_blk = b;
+			break;
+		case H_IF:
+			if (b->h.h_data == -1) {
+				expect = 1;
+				role = R_COND;
+			}
+			break;
+		case H_WHILE:
+		case H_DOWHILE:
+			if (b->h.h_data == -1) {
+				expect = 1;
+				role = R_FIXED;
+			}
+			break;
+		case H_SWITCH:
+			expect = 1;
+			role = R_FIXED;
+			break;
+		case H_FOR:
+			expect = 3;
+			role = R_FIXED;
+			break;
+		case H_RETURN:
+			expect = 1;
+			role = R_RETURN;
+			break;
+		}
+	}
+}
+
+static void do_function(struct block *func)
+{
+	struct block *b;
+	unsigned i;
+
+	nslot = 0;
+	escaped = 0;
+	dead = 0;
+	frame_blk = NULL;
+	ntemp = 0;
+
+	set_roles(func);
+	for (b = func; b; b = b->next) {
+		if (b->kind != '^')
+			continue;
+		/* cc1 marks a return value as a side effect, which would make
+		   it look like a volatile read. walk_tree() puts it back */
+		if (b->role == R_RETURN)
+			b->n->flags &= ~SIDEEFFECT;
+		scan_slots(b->n, NULL);
+	}
+	check_slots();
+	clear_facts();
+
+	for (b = func; b; b = b->next) {
+		changed = 0;
+		if (b->kind == 'H')
+			walk_header(b);
+		else if (b->kind == '^')
+			walk_tree(b);
+		b->dirty |= changed;
+	}
+	prune(func);
+
+	for (i = 0; i < nslot; i++)
+		slots[i].reads = 0;
+	for (b = func; b; b = b->next)
+		if (b->kind == '^' && b->n)
+			count_reads(b->n);
+	for (b = func; b; b = b->next)
+		if (b->kind == '^' && b->n)
+			dead_stores(b, &b->n, 0);
+
+	if (frame_blk) {
+		for (b = func; b; b = b->next) {
+			if (b->kind != '^' || b->n == NULL)
+				continue;
+			if (b->role != R_STMT && b->role != R_RETURN)
+				continue;
+			changed = 0;
+			cse_tree(&b->n);
+			b->dirty |= changed;
+		}
+	}
+
+	for (b = func; b; b = b->next)
+		if (b->kind == '^' && b->n && b->dirty)
+			b->n = tidy(b->n);
+}
+
+int main(int argc, char *argv[])
+{
+	struct block *func = NULL;
+	struct block **tail = NULL;
+	struct block *b;
+	int c;
+
+	argv0 = argv[0];
+	if (argc != 1) {
+		fprintf(stderr, "%s: usage: %s < in > out\n", argv0, argv0);
+		exit(1);
+	}
+	if (getchar() != '%' || getchar() != 'V' || in_byte() != TREE_VERSION)
+		error("bad stream");
+	printf("%%V%c", TREE_VERSION);
+
+	while ((c = getchar()) != EOF) {
+		if (c != '%')
+			error("sync");
+		b = read_block(in_byte());
+		if (func == NULL) {
+			if (b->kind == 'H' && b->h.h_type == H_FUNCTION) {
+				func = b;
+				tail = &b->next;
+				continue;
+			}
+			write_block(b);
+			free_block(b);
+			continue;
+		}
+		*tail = b;
+		tail = &b->next;
+		if (b->kind == 'H' && b->h.h_type == (H_FUNCTION | H_FOOTER)) {
+			do_function(func);
+			while (func) {
+				b = func->next;
+				write_block(func);
+				free_block(func);
+				func = b;
+			}
+		}
+	}
+	if (func)
+		error("short read");
+	if (fflush(stdout) || ferror(stdout))
+		error("write error");
+	return 0;
+}
@@ -1,6 +1,31 @@
 
 /* Pass 2 values */
 
+/* Hosted builds take expression nodes and index data from arenas that
+   grow as needed, and have room for much more of everything else. They
+   also buffer the output in memory, and cc2 keeps every name rather than
+   a small cache. Build with -DSMALLPOOL to get the fixed pools, record
+   I/O and name cache used on a small box */
+#if defined(__linux__) && !defined(SMALLPOOL)
+#define ARENA
+#define BIGIO
+#endif
+
+#ifdef ARENA
+
+/* The type encoding has room for 1024 symbol slots */
+#define MAXSYM			1024
+/* Expression nodes per arena chunk */
+#define NUM_NODES		1024
+/* Words of index data per arena chunk */
+#define IDX_SIZE		4096
+#define MAXLABEL		256
+#define NUM_STRUCT_FIELD	256
+#define NUM_SWITCH		1024
+#define NUM_CONSTANT		1024
+
+#else
+
 /* This controls the number of symbols (including complex types, arrays and
    unique function prototypes. Cost is 10 bytes per node on a small box. We
    can probably make symbols the self expanding one eventually */
@@ -20,8 +45,11 @@
 /* Number of constants from enum. 4 bytes per entry */
 #define NUM_CONSTANT		50
 
+#endif
+
 #include <stdio.h>
 
+#include "arena.h"
 #include "symbol.h"
 
 #include "body.h"
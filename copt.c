@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <unistd.h>
 
 int rpn_eval(const char* expr, char** vars);
 
@@ -61,11 +63,11 @@ void error(char* s)
     exit(1);
 }
 
-/* connect - connect p1 to p2 */
-void connect(struct lnode* p1, struct lnode* p2)
+/* lconnect - connect p1 to p2 */
+void lconnect(struct lnode* p1, struct lnode* p2)
 {
     if (p1 == 0 || p2 == 0)
-        error("connect: can't happen\n");
+        error("lconnect: can't happen\n");
     p1->l_next = p2;
     p2->l_prev = p1;
 }
@@ -112,8 +114,8 @@ void insert(char* s, struct lnode* p)
     if (n == NULL)
         error("insert: out of memory\n");
     n->l_text = s;
-    connect(p->l_prev, n);
-    connect(n, p);
+    lconnect(p->l_prev, n);
+    lconnect(n, p);
 }
 
 /* getlst - link lines from fp in between p1 and p2 */
@@ -121,7 +123,7 @@ void getlst(FILE* fp, char* quit, struct lnode* p1, struct lnode* p2)
 {
     char lin[MAXLINE];
 
-    connect(p1, p2);
+    lconnect(p1, p2);
     while (fgets(lin, MAXLINE, fp) != NULL && strcmp(lin, quit)) {
         insert(install(lin), p2);
     }
@@ -134,7 +136,7 @@ void getlst_1(FILE* fp, char* quit, struct lnode* p1, struct lnode* p2)
     char lin[MAXLINE];
     int firstline = 1;
 
-    connect(p1, p2);
+    lconnect(p1, p2);
     while (fgets(lin, MAXLINE, fp) != NULL && strcmp(lin, quit)) {
         if (firstline) {
             char* p = lin;
@@ -345,7 +347,7 @@ struct lnode* rep(
             fputs(p->l_text, stderr);
         free(p);
     }
-    connect(p1, p2);
+    lconnect(p1, p2);
     if (debug)
         fputs("=\n", stderr);
     for (; new; new = new->l_next) {
@@ -365,7 +367,7 @@ struct lnode* copylist(
     struct lnode head, tail, *more = 0;
     int pattern = 1; /* allow nested rules */
     int i;
-    connect(&head, &tail);
+    lconnect(&head, &tail);
     head.l_prev = tail.l_next = 0;
 
     for (i = 0; i < LASTLAB - FIRSTLAB + 1; ++i)
@@ -379,7 +381,7 @@ struct lnode* copylist(
             *pat = tail.l_prev;
             head.l_next->l_prev = 0;
             tail.l_prev->l_next = 0;
-            connect(&head, &tail);
+            lconnect(&head, &tail);
             continue;
         }
         if (strcmp(source->l_text, "%activate\n") == 0) {
@@ -525,27 +527,32 @@ struct lnode* opt(struct lnode* r)
     return r->l_next;
 }
 
-/* #define _TESTING */
-
-/* main - peephole optimizer */
-int main(int argc, char** argv)
+/* load_rules - read the patterns files named on the command line */
+void load_rules(int argc, char** argv)
 {
     FILE* fp;
-
-    int i, pass;
-    struct lnode head, *p, tail;
+    int i;
 
     for (i = 1; i < argc; i++)
         if (strcasecmp(argv[i], "-D") == 0)
             debug = 1;
+        else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "-c") == 0)
+            i++;
         else if ((fp = fopen(argv[i], "r")) == NULL)
             error("copt: can't open patterns file\n");
-        else
+        else {
             init(fp);
+            fclose(fp);
+        }
+}
 
-    getlst(stdin, "", &head, &tail);
+/* run_passes - run the rules over the lines between head and tail */
+void run_passes(struct lnode* head, struct lnode* tail)
+{
+    int pass;
+    struct lnode* p;
 
-    head.l_text = tail.l_text = "";
+    head->l_text = tail->l_text = "";
 
     pass = 0;
     do {
@@ -553,7 +560,7 @@ int main(int argc, char** argv)
         if (debug)
             fprintf(stderr, "\n--- pass %d ---\n", pass);
         global_again = 0;
-        for (p = head.l_next; p != &tail; p = opt(p))
+        for (p = head->l_next; p != tail; p = opt(p))
             ;
     } while (global_again && pass < MAX_PASS);
 
@@ -561,8 +568,410 @@ int main(int argc, char** argv)
         fprintf(stderr, "error: maximum of %d passes exceeded\n", MAX_PASS);
         error("       check for recursive substitutions");
     }
+}
+
+/* optimize - run the rules over stdin and write the result to stdout */
+void optimize(void)
+{
+    struct lnode head, tail;
 
+    getlst(stdin, "", &head, &tail);
+    run_passes(&head, &tail);
     printlines(head.l_next, &tail, stdout);
+}
+
+/*
+ *	Function cache mode (copt -c dir rules...). cc2 marks each function it
+ *	generates with ;%%F key before it and ;%%E state after it, and each
+ *	one it found in the cache with ;%%H key. Functions are optimized on
+ *	their own and stored under their key along with the state line, the
+ *	code between them is optimized a piece at a time as it comes. Entries
+ *	not used by this run are removed at the end.
+ */
+
+static const char* cache_dir;
+static char** cache_used;
+static int cache_nused;
+
+char* cache_path(const char* key)
+{
+    static char buf[512];
+    if (strlen(cache_dir) + strlen(key) + 2 > sizeof(buf))
+        error("copt: cache path too long\n");
+    sprintf(buf, "%s/%s", cache_dir, key);
+    return buf;
+}
+
+/* cache_key - pick the key out of a marker line and note it is in use */
+char* cache_key(char* lin)
+{
+    char* p = lin + 5;
+    p[strcspn(p, "\n")] = 0;
+    cache_used = realloc(cache_used, (cache_nused + 1) * sizeof(char*));
+    if (cache_used == NULL)
+        error("copt: out of memory\n");
+    cache_used[cache_nused++] = install(p);
+    return cache_used[cache_nused - 1];
+}
+
+/* cache_flush - optimize and write out the lines gathered so far */
+void cache_flush(struct lnode* head, struct lnode* tail)
+{
+    run_passes(head, tail);
+    printlines(head->l_next, tail, stdout);
+    lconnect(head, tail);
+}
+
+/* cache_store - optimize a function and save it as well as writing it */
+void cache_store(char* key, char* state, struct lnode* head, struct lnode* tail)
+{
+    char tmp[512];
+    FILE* fp;
+    int fd;
+
+    run_passes(head, tail);
+    printlines(head->l_next, tail, stdout);
+    strcpy(tmp, cache_path("tmpXXXXXX"));
+    fd = mkstemp(tmp);
+    if (fd != -1 && (fp = fdopen(fd, "w")) != NULL) {
+        fputs(state, fp);
+        printlines(head->l_next, tail, fp);
+        if (fclose(fp) == 0)
+            rename(tmp, cache_path(key));
+        else
+            unlink(tmp);
+    }
+    lconnect(head, tail);
+}
+
+/* cache_fetch - copy out a cached function, less its state line */
+void cache_fetch(char* key)
+{
+    char lin[MAXLINE];
+    FILE* fp = fopen(cache_path(key), "r");
+    size_t n;
+
+    if (fp == NULL || fgets(lin, MAXLINE, fp) == NULL)
+        error("copt: cache entry missing\n");
+    while ((n = fread(lin, 1, MAXLINE, fp)) > 0)
+        fwrite(lin, 1, n, stdout);
+    fclose(fp);
+}
+
+/* cache_prune - remove entries nobody used this time */
+void cache_prune(void)
+{
+    DIR* d = opendir(cache_dir);
+    struct dirent* de;
+    int i;
+
+    if (d == NULL)
+        return;
+    while ((de = readdir(d)) != NULL) {
+        if (strlen(de->d_name) != 16)
+            continue;
+        for (i = 0; i < cache_nused; i++)
+            if (strcmp(cache_used[i], de->d_name) == 0)
+                break;
+        if (i == cache_nused)
+            unlink(cache_path(de->d_name));
+    }
+    closedir(d);
+}
+
+void optimize_cached(void)
+{
+    char lin[MAXLINE];
+    struct lnode head, tail;
+    char* key = NULL;
+
+    lconnect(&head, &tail);
+    while (fgets(lin, MAXLINE, stdin) != NULL) {
+        if (strncmp(lin, ";%%", 3) != 0 || lin[4] != ' ') {
+            insert(install(lin), &tail);
+            continue;
+        }
+        switch (lin[3]) {
+        case 'F':
+            cache_flush(&head, &tail);
+            key = cache_key(lin);
+            break;
+        case 'E':
+            if (key == NULL)
+                error("copt: bad cache marker\n");
+            cache_store(key, lin + 5, &head, &tail);
+            key = NULL;
+            break;
+        case 'H':
+            cache_flush(&head, &tail);
+            cache_fetch(cache_key(lin));
+            break;
+        default:
+            insert(install(lin), &tail);
+        }
+    }
+    cache_flush(&head, &tail);
+    cache_prune();
+}
+
+#if defined(__linux__)
+
+/*
+ *	Server mode (copt -s socket rules...). The rules are loaded once and
+ *	each connection hands us the input, output and error descriptors for
+ *	a job. A forked copy runs the job so that it starts from the rules as
+ *	loaded, whatever firing and %activate do to them, and reports a
+ *	status byte back. We go away after sitting idle for a while, and
+ *	reload the rules if the files change under us. If copt itself is
+ *	replaced we hand the job to the new one and leave the socket to the
+ *	next server fcc starts.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define SERVER_IDLE 300 /* seconds */
+
+static time_t rules_time;
+static time_t self_time;
+
+/* self_stamp - modification time of the copt binary we were run as */
+time_t self_stamp(char** argv)
+{
+    struct stat st;
+
+    if (strchr(argv[0], '/') == NULL || stat(argv[0], &st))
+        return 0;
+    return st.st_mtime;
+}
+
+/* rules_stamp - newest modification time of the patterns files and copt */
+time_t rules_stamp(int argc, char** argv)
+{
+    struct stat st;
+    time_t t = self_stamp(argv);
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "-c") == 0)
+            i++;
+        else if (stat(argv[i], &st) == 0 && st.st_mtime > t)
+            t = st.st_mtime;
+    }
+    return t;
+}
+
+/* free_rules - throw away the loaded rule set before a reload */
+void free_rules(void)
+{
+    struct onode* o;
+    struct lnode *l, *n;
+
+    while ((o = opts) != NULL) {
+        opts = o->o_next;
+        for (l = o->o_old; l; l = n) {
+            n = l->l_prev;
+            free(l);
+        }
+        for (l = o->o_new; l; l = n) {
+            n = l->l_next;
+            free(l);
+        }
+        free(o);
+    }
+}
+
+/* take_job - collect the descriptors for the job on fd */
+void take_job(int fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cm;
+    union {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } cbuf;
+    int fds[3];
+    char c;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf.buf;
+    msg.msg_controllen = sizeof(cbuf.buf);
+    if (recvmsg(fd, &msg, 0) != 1)
+        exit(1);
+    cm = CMSG_FIRSTHDR(&msg);
+    if (cm == NULL || cm->cmsg_type != SCM_RIGHTS
+        || cm->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        exit(1);
+    memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    dup2(fds[0], 0);
+    dup2(fds[1], 1);
+    dup2(fds[2], 2);
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[2]);
+}
+
+/* serve_job - run one job for the client on fd and report back */
+void serve_job(int fd)
+{
+    char c;
+
+    take_job(fd);
+    optimize();
+    /* If we die on the way the client sees end of file instead */
+    c = fflush(stdout) != 0;
+    write(fd, &c, 1);
+    exit(0);
+}
+
+/* serve_exec - run the job on fd with the copt now installed */
+void serve_exec(int fd, int argc, char** argv)
+{
+    char** av;
+    pid_t pid;
+    int i, n = 0;
+    int status = 1;
+    char c;
+
+    take_job(fd);
+    av = (char**)malloc((argc + 1) * sizeof(char*));
+    if (av == NULL)
+        error("copt: out of memory\n");
+    for (i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0)
+            i++;
+        else
+            av[n++] = argv[i];
+    }
+    av[n] = NULL;
+    signal(SIGCHLD, SIG_DFL);
+    pid = fork();
+    if (pid == 0) {
+        execv(av[0], av);
+        _exit(255);
+    }
+    if (pid != -1)
+        waitpid(pid, &status, 0);
+    c = status != 0;
+    write(fd, &c, 1);
+    exit(0);
+}
+
+/* serve - accept jobs on the socket at path */
+void serve(const char* path, int argc, char** argv)
+{
+    struct sockaddr_un sun;
+    struct pollfd pfd;
+    time_t t;
+    int ls, fd;
+    int closing = 0;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sun.sun_path))
+        error("copt: socket path too long\n");
+    strcpy(sun.sun_path, path);
+
+    ls = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ls == -1)
+        error("copt: can't create socket\n");
+    if (bind(ls, (struct sockaddr*)&sun, sizeof(sun)) == -1) {
+        if (errno != EADDRINUSE)
+            error("copt: can't bind socket\n");
+        /* Either someone beat us to it or it is left over */
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr*)&sun, sizeof(sun)) == 0)
+            exit(0);
+        close(fd);
+        unlink(path);
+        if (bind(ls, (struct sockaddr*)&sun, sizeof(sun)) == -1)
+            error("copt: can't bind socket\n");
+    }
+    if (listen(ls, 16) == -1)
+        error("copt: can't listen on socket\n");
+
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    rules_time = rules_stamp(argc, argv);
+    self_time = self_stamp(argv);
+
+    pfd.fd = ls;
+    pfd.events = POLLIN;
+    for (;;) {
+        if (!closing && poll(&pfd, 1, SERVER_IDLE * 1000) == 0) {
+            /* Take the name away and then finish anyone who got in
+               before we did */
+            unlink(path);
+            fcntl(ls, F_SETFL, O_NONBLOCK);
+            closing = 1;
+        }
+        fd = accept(ls, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                exit(0);
+            continue;
+        }
+        t = rules_stamp(argc, argv);
+        if (t != rules_time) {
+            rules_time = t;
+            if (self_stamp(argv) != self_time) {
+                if (!closing)
+                    unlink(path);
+                close(ls);
+                if (fork() == 0)
+                    serve_exec(fd, argc, argv);
+                exit(0);
+            }
+            free_rules();
+            load_rules(argc, argv);
+        }
+        if (fork() == 0) {
+            close(ls);
+            serve_job(fd);
+        }
+        close(fd);
+    }
+}
+
+#endif
+
+/* #define _TESTING */
+
+/* main - peephole optimizer */
+int main(int argc, char** argv)
+{
+    int i;
+
+    load_rules(argc, argv);
+
+    for (i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "-s") == 0) {
+#if defined(__linux__)
+            serve(argv[i + 1], argc, argv);
+#else
+            error("copt: server mode is not supported\n");
+#endif
+        }
+        if (strcmp(argv[i], "-c") == 0)
+            cache_dir = argv[i + 1];
+    }
+
+    if (cache_dir)
+        optimize_cached();
+    else
+        optimize();
     exit(0);
     return 1; /* make compiler happy */
 }
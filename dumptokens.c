@@ -37,10 +37,16 @@ unsigned getquad(void)
 	return n;
 }
 
-unsigned gettok(void)
+unsigned getvarint(void)
 {
-	unsigned n = getbyte();
-	n |= getbyte() << 8;
+	unsigned n = 0;
+	unsigned shift = 0;
+	unsigned c;
+	do {
+		c = getbyte();
+		n |= (c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
 	return n;
 }
 
@@ -65,6 +71,53 @@ void dostring(void)
 	printf("\n");
 }
 
+static const char unitok[] = TK_UNICHARS;
+static unsigned line;
+
+/* Undo the compact stream encoding, see token.h */
+unsigned gettok(void)
+{
+	unsigned c = getbyte();
+
+	if (c >= TK_SYMBOL2)
+		return T_SYMBOL + TK_NSYM1 + ((c - TK_SYMBOL2) << 8) + getbyte();
+	if (c >= TK_SYMBOL)
+		return T_SYMBOL + c - TK_SYMBOL;
+	if (c >= TK_NEXTLINE) {
+		line += c - TK_NEXTLINE + 1;
+		return T_LINE;
+	}
+	if (c == TK_LINE) {
+		c = getvarint();
+		if (c & 1)
+			line -= c >> 1;
+		else
+			line += c >> 1;
+		return T_LINE;
+	}
+	if (c == TK_FILE) {
+		line = getvarint();
+		printf("File ");
+		dostring();
+		return T_LINE;
+	}
+	if (c == TK_FULL)
+		return getpair();
+	if (c >= TK_KEYWORD)
+		return T_KEYWORD + c - TK_KEYWORD;
+	if (c >= TK_VALUE)
+		return T_INTVAL + c - TK_VALUE;
+	if (c >= TK_SYMEQ)
+		return T_PLUSEQ + c - TK_SYMEQ;
+	if (c >= TK_DOUBLESYM)
+		return T_PLUSPLUS + c - TK_DOUBLESYM;
+	if (c >= TK_SPECIAL)
+		return T_SHLEQ + c - TK_SPECIAL;
+	if (c == TK_EOF)
+		return T_EOF;
+	return unitok[c - TK_UNI];
+}
+
 unsigned decode_token(void)
 {
 	unsigned n = gettok();
@@ -89,6 +142,10 @@ unsigned decode_token(void)
 		printf("->\n");
 		break;
 
+	case T_ELLIPSIS:
+		printf("...\n");
+		break;
+
 	case T_PLUSPLUS:
 		printf("++\n");
 		break;
@@ -137,6 +194,12 @@ unsigned decode_token(void)
 	case T_PERCENTEQ:
 		printf("%%=\n");
 		break;
+	case T_LTEQ:
+		printf("<=\n");
+		break;
+	case T_GTEQ:
+		printf(">=\n");
+		break;
 
 	case T_LPAREN:
 		printf("(\n");
@@ -147,6 +210,9 @@ unsigned decode_token(void)
 	case T_LSQUARE:
 		printf("[\n");
 		break;
+	case T_RSQUARE:
+		printf("]\n");
+		break;
 	case T_LCURLY:
 		printf("{\n");
 		break;
@@ -304,20 +370,26 @@ unsigned decode_token(void)
 	case T_WHILE:
 		printf("while\n");
 		break;
+	case T_RESTRICT:
+		printf("restrict\n");
+		break;
 
 	case T_INTVAL:
-		printf("int %d\n", getquad());
+		printf("int %d\n", getvarint());
 		break;
 	case T_UINTVAL:
-		printf("uint %u\n", getquad());
+		printf("uint %u\n", getvarint());
 		break;
 		/* We are using 32bit longs for target so this isnt portable but ok for
 		   debugging on Linux */
 	case T_LONGVAL:
-		printf("long %d\n", getquad());
+		printf("long %d\n", getvarint());
 		break;
 	case T_ULONGVAL:
-		printf("ulong %u\n", getquad());
+		printf("ulong %u\n", getvarint());
+		break;
+	case T_FLOATVAL:
+		printf("float %08x\n", getquad());
 		break;
 	case T_STRING:
 		printf("string: ");
@@ -327,7 +399,7 @@ unsigned decode_token(void)
 		printf("$end\n");
 		break;
 	case T_LINE:
-		printf("Line %d\n", getpair());
+		printf("Line %d\n", line);
 		break;
 	default:
 		if (n >= T_SYMBOL)
@@ -343,6 +415,10 @@ unsigned decode_token(void)
 
 int main(int argc, char *argv[])
 {
+	if (getbyte() != TK_MAGIC || getbyte() != TK_VERSION) {
+		printf("Not a version %d token stream\n", TK_VERSION);
+		exit(1);
+	}
 	while (decode_token());
 	return 0;
 }
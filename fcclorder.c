@@ -0,0 +1,265 @@
+/*
+ *	Order a set of object files for an archive so that each one comes
+ *	before the ones it needs. This does the job of lorder | tsort in one
+ *	go without the temporary files, sorts and joins.
+ *
+ *	fcclorder [-n nm] [-d types] file.o ...
+ *
+ *	The symbols come from a single nm -g run over all the objects. nm
+ *	names each file on a line ending with a colon, and each symbol line
+ *	ends with the symbol type and name. Symbols with one of the
+ *	definition types are defined by that file, anything else is a
+ *	reference to another.
+ *
+ *	Members that are not ordered by any dependency keep the order they
+ *	were given in, so the output is stable from run to run. If there is a
+ *	loop we say so, as tsort does, and break it at the earliest member.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NHASH	1024
+
+struct sym {
+	struct sym *next;
+	int def;		/* Defining file or -1 */
+	char name[1];
+};
+
+struct ref {
+	int file;
+	struct sym *sym;
+};
+
+static const char *nm = "nm";
+static const char *deftypes = "ACDBLXZSsb";
+
+static char **files;
+static int nfiles;
+
+static struct sym *symhash[NHASH];
+static struct ref *refs;
+static unsigned nrefs;
+static unsigned maxrefs;
+
+static unsigned *indeg;
+static unsigned *first;		/* Edges out of file n are first[n]..first[n+1]-1 */
+static int *edge;
+static char *done;
+
+static void *xmalloc(size_t n)
+{
+	void *p = malloc(n);
+	if (p == NULL) {
+		fprintf(stderr, "fcclorder: out of memory.\n");
+		exit(1);
+	}
+	return p;
+}
+
+static struct sym *lookup(const char *name)
+{
+	struct sym *s;
+	unsigned h = 0;
+	const char *p = name;
+
+	while (*p)
+		h = h * 31 + (unsigned char)*p++;
+	h %= NHASH;
+	for (s = symhash[h]; s; s = s->next)
+		if (strcmp(s->name, name) == 0)
+			return s;
+	s = xmalloc(sizeof(struct sym) + strlen(name));
+	strcpy(s->name, name);
+	s->def = -1;
+	s->next = symhash[h];
+	symhash[h] = s;
+	return s;
+}
+
+static void add_ref(int file, struct sym *s)
+{
+	if (nrefs == maxrefs) {
+		maxrefs = maxrefs ? 2 * maxrefs : 1024;
+		refs = realloc(refs, maxrefs * sizeof(struct ref));
+		if (refs == NULL) {
+			fprintf(stderr, "fcclorder: out of memory.\n");
+			exit(1);
+		}
+	}
+	refs[nrefs].file = file;
+	refs[nrefs++].sym = s;
+}
+
+static int find_file(const char *name)
+{
+	int i;
+	for (i = 0; i < nfiles; i++)
+		if (strcmp(files[i], name) == 0)
+			return i;
+	return -1;
+}
+
+/* Run nm over everything and record who defines and who wants what */
+static void read_symbols(void)
+{
+	static char line[512];
+	char *cmd, *p, *name;
+	size_t len = strlen(nm) + 4;
+	FILE *fp;
+	int cur;
+	int i;
+
+	for (i = 0; i < nfiles; i++)
+		len += strlen(files[i]) + 3;
+	cmd = xmalloc(len);
+	sprintf(cmd, "%s -g", nm);
+	for (i = 0; i < nfiles; i++) {
+		if (strchr(files[i], '\'')) {
+			fprintf(stderr, "fcclorder: bad file name '%s'.\n", files[i]);
+			exit(1);
+		}
+		strcat(cmd, " '");
+		strcat(cmd, files[i]);
+		strcat(cmd, "'");
+	}
+	fp = popen(cmd, "r");
+	if (fp == NULL) {
+		perror(nm);
+		exit(1);
+	}
+	/* With one file nm may not bother to name it */
+	cur = nfiles == 1 ? 0 : -1;
+	while (fgets(line, sizeof(line), fp)) {
+		p = line + strlen(line);
+		while (p > line && (p[-1] == '\n' || p[-1] == ' '))
+			*--p = '\0';
+		if (p == line)
+			continue;
+		if (p[-1] == ':') {
+			p[-1] = '\0';
+			cur = find_file(line);
+			continue;
+		}
+		if (cur == -1)
+			continue;
+		name = strrchr(line, ' ');
+		if (name == NULL || name == line)
+			continue;
+		*name++ = '\0';
+		/* The type letter is the last thing before the name */
+		if (name - 2 > line && name[-3] != ' ')
+			continue;
+		if (strchr(deftypes, name[-2])) {
+			struct sym *s = lookup(name);
+			if (s->def == -1)
+				s->def = cur;
+		} else
+			add_ref(cur, lookup(name));
+	}
+	if (pclose(fp)) {
+		fprintf(stderr, "fcclorder: %s failed.\n", nm);
+		exit(1);
+	}
+	free(cmd);
+}
+
+/* A file must come before every file defining something it uses */
+static void build_graph(void)
+{
+	unsigned *fill;
+	unsigned i;
+	int d;
+
+	indeg = xmalloc(nfiles * sizeof(unsigned));
+	first = xmalloc((nfiles + 1) * sizeof(unsigned));
+	fill = xmalloc(nfiles * sizeof(unsigned));
+	memset(indeg, 0, nfiles * sizeof(unsigned));
+	memset(first, 0, (nfiles + 1) * sizeof(unsigned));
+
+	for (i = 0; i < nrefs; i++) {
+		d = refs[i].sym->def;
+		if (d != -1 && d != refs[i].file)
+			first[refs[i].file + 1]++;
+	}
+	for (d = 0; d < nfiles; d++) {
+		first[d + 1] += first[d];
+		fill[d] = first[d];
+	}
+	edge = xmalloc((first[nfiles] + 1) * sizeof(int));
+	for (i = 0; i < nrefs; i++) {
+		d = refs[i].sym->def;
+		if (d != -1 && d != refs[i].file) {
+			edge[fill[refs[i].file]++] = d;
+			indeg[d]++;
+		}
+	}
+	free(fill);
+}
+
+static void emit(int n)
+{
+	unsigned i;
+
+	done[n] = 1;
+	puts(files[n]);
+	for (i = first[n]; i < first[n + 1]; i++)
+		indeg[edge[i]]--;
+}
+
+static void order(void)
+{
+	int left = nfiles;
+	int i;
+
+	done = xmalloc(nfiles);
+	memset(done, 0, nfiles);
+	while (left) {
+		for (i = 0; i < nfiles; i++)
+			if (!done[i] && indeg[i] == 0)
+				break;
+		if (i == nfiles) {
+			for (i = 0; done[i]; i++);
+			fprintf(stderr, "fcclorder: cycle involving %s.\n", files[i]);
+		}
+		emit(i);
+		left--;
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: fcclorder [-n nm] [-d types] file ...\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (argv[i][1] == 0 || argv[i][2] != 0 || i + 1 == argc)
+			usage();
+		switch (argv[i][1]) {
+		case 'n':
+			nm = argv[++i];
+			break;
+		case 'd':
+			deftypes = argv[++i];
+			break;
+		default:
+			usage();
+		}
+	}
+	if (i == argc)
+		usage();
+	files = argv + i;
+	nfiles = argc - i;
+
+	read_symbols();
+	build_graph();
+	order();
+	return 0;
+}
@@ -13,10 +13,15 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <ctype.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "symtab.h"
 #include "token.h"
 #include "target.h"
+#include "preproc.h"
 
 static char *symtab;
 
@@ -95,11 +100,11 @@ static void writes(const char *p)
 	write(2, p, len);
 }
 
-static void report(char code, const char *p)
+static void report_at(const char *name, unsigned n, char code, const char *p)
 {
-	writes((const char *) filename);
+	writes(name);
 	colonspace();
-	writes(_itoa(line));
+	writes(_itoa(n));
 	colonspace();
 	write(2, &code, 1);
 	colonspace();
@@ -107,6 +112,11 @@ static void report(char code, const char *p)
 	write(2, "\n", 1);
 }
 
+static void report(char code, const char *p)
+{
+	report_at((const char *) filename, line, code, p);
+}
+
 void error(const char *p)
 {
 	report('E', p);
@@ -118,17 +128,59 @@ void warning(const char *p)
 	report('W', p);
 }
 
+/* For the preprocessor which knows better where it is */
+void error_at(const char *name, unsigned n, const char *p)
+{
+	report_at(name, n, 'E', p);
+	err++;
+}
+
+void warning_at(const char *name, unsigned n, const char *p)
+{
+	report_at(name, n, 'W', p);
+}
+
 void fatal(const char *p)
 {
 	error(p);
 	exit(1);
 }
 
+/* Hosted we use big buffers and map the input if it is a file. Build
+   with -DBLOCKIO to use the small block I/O as on CP/M and Fuzix */
+#if defined(__linux__) && !defined(BLOCKIO)
+#define BIGIO
+#define BLOCK 65536
+#else
 #define BLOCK 512
+#endif
 
 static uint8_t buffer[BLOCK];	/* 128 for CPM */
 static uint8_t *bufptr = buffer + BLOCK;
+#ifdef BIGIO
+static size_t bufleft = 0;
+static unsigned mapped;
+
+static void map_input(void)
+{
+	struct stat st;
+	void *p;
+
+	if (fstat(0, &st) || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return;
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 0, 0);
+	if (p == MAP_FAILED)
+		return;
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+	bufptr = p;
+	bufleft = st.st_size;
+	mapped = 1;
+}
+#else
 static uint16_t bufleft = 0;
+#endif
+
+static unsigned preprocess;	/* Doing our own cpp */
 
 /* Pull the input stream in blocks and optimize for our case as this
    is of course a very hot path. This design allows for future running
@@ -137,10 +189,23 @@ static uint16_t bufleft = 0;
 
 static unsigned bgetc(void)
 {
+	int n;
+
 	if (bufleft == 0) {
-		bufleft = read(0, buffer, BLOCK);
-		if (bufleft == 0)
+#ifdef BIGIO
+		/* The map is the whole file */
+		if (mapped)
+			return EOF;
+#endif
+		if (preprocess)
+			n = pp_read(buffer, BLOCK);
+		else
+			n = read(0, buffer, BLOCK);
+		if (n < 0)
+			fatal("read error");
+		if (n == 0)
 			return EOF;
+		bufleft = n;
 		bufptr = buffer;
 	}
 	bufleft--;
@@ -260,17 +325,88 @@ static void directive(void)
 }
 
 
-#define NHASH	64
-
 /* We could infer the symbol number from the table position in theory */
 
+#if defined(__linux__)
+/* Hosted the table grows as needed and the hash grows with it */
+#define INITNAME	512
+static struct name *symbols;
+static struct name *symend;
+static struct name **symhash;
+static unsigned nhash;
+#else
+#define NHASH	64
 static struct name symbols[MAXNAME];
+#define symend	(symbols + MAXNAME)
+static struct name *symhash[NHASH];
+#define nhash	NHASH
+#endif
+#if defined(__linux__)
+static struct name *nextsym;
+#else
 static struct name *nextsym = symbols;
+#endif
 static struct name *symbase;	/* Base of post keyword symbols */
-static struct name *symhash[NHASH];
 /* Start of symbol range */
 static unsigned symnum = T_SYMBOL;
 
+static struct name *symdone;	/* Written to the symbol table file */
+
+/*
+ *	Hash a name. A multiplicative hash when we can afford it, otherwise
+ *	shift and add which is still far better than adding up the bytes.
+ */
+static unsigned hash_symbol(const char *name)
+{
+	uint8_t n = 0;
+#if defined(__linux__)
+	uint32_t hash = 2166136261UL;
+
+	while (*name && n++ < NAMELEN)
+		hash = (hash ^ (uint8_t)*name++) * 16777619UL;
+#else
+	unsigned hash = 0;
+
+	while (*name && n++ < NAMELEN)
+		hash = (hash << 5) + hash + (uint8_t)*name++;
+#endif
+	return hash;
+}
+
+static void link_symbol(struct name *s, unsigned hash)
+{
+	hash &= nhash - 1;
+	s->next = symhash[hash];
+	symhash[hash] = s;
+}
+
+#if defined(__linux__)
+/*
+ *	Double the table, keeping the load on the hash to two names a chain
+ */
+static void grow_symbols(void)
+{
+	struct name *old = symbols;
+	struct name *s;
+	unsigned n = symbols ? 2 * (symend - symbols) : INITNAME;
+
+	symbols = realloc(symbols, n * sizeof(struct name));
+	free(symhash);
+	nhash = n / 2;
+	symhash = calloc(nhash, sizeof(struct name *));
+	if (symbols == NULL || symhash == NULL)
+		fatal("out of memory");
+	nextsym = symbols + (nextsym - old);
+	if (symbase)
+		symbase = symbols + (symbase - old);
+	if (symdone)
+		symdone = symbols + (symdone - old);
+	symend = symbols + n;
+	for (s = symbols; s < nextsym; s++)
+		link_symbol(s, hash_symbol(s->name));
+}
+#endif
+
 /*
  *	Add a symbol to our symbol tables as we discover it. Log the
  *	fact if tracing.
@@ -278,13 +414,17 @@ static unsigned symnum = T_SYMBOL;
 static struct name *new_symbol(const char *name, unsigned hash, unsigned id)
 {
 	struct name *s;
-	if (nextsym == symbols + MAXNAME)
+	if (nextsym == symend) {
+#if defined(__linux__)
+		grow_symbols();
+#else
 		fatal("too many sybmols");
+#endif
+	}
 	s = nextsym++;
 	strncpy(s->name, name, NAMELEN);
-	s->next = symhash[hash];
 	s->id = id;
-	symhash[hash] = s;
+	link_symbol(s, hash);
 	return s;
 }
 
@@ -293,7 +433,7 @@ static struct name *new_symbol(const char *name, unsigned hash, unsigned id)
  */
 static struct name *find_symbol(const char *name, unsigned hash)
 {
-	struct name *s = symhash[hash];
+	struct name *s = symhash[hash & (nhash - 1)];
 	while (s) {
 		if (strncmp(s->name, name, NAMELEN) == 0)
 			return s;
@@ -303,17 +443,32 @@ static struct name *find_symbol(const char *name, unsigned hash)
 }
 
 /*
- *	A simple but adequate hashing algorithm. A better one would
- *	be worth it for performance.
+ *	The symbol table is written out as we go. Any names we have found
+ *	are on disk before the tokens that use them are, so that the later
+ *	passes can be run on the end of a pipe from us.
  */
-static unsigned hash_symbol(const char *name)
+static int symfd = -1;
+
+static void open_symbol_table(void)
 {
-	int hash = 0;
-	uint8_t n = 0;
+	/* FIXME: proper temporary file! */
+	symfd = open(symtab, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (symfd == -1) {
+		perror(symtab);
+		exit(1);
+	}
+	/* Size is filled in at the end */
+	if (write(symfd, "\0\0", 2) != 2)
+		error("symbol I/O");
+	symdone = symbase;
+}
 
-	while (*name && n++ < NAMELEN)
-		hash += *name++;
-	return (hash & (NHASH - 1));
+static void sync_symbol_table(void)
+{
+	unsigned len = (uint8_t *) nextsym - (uint8_t *) symdone;
+	if (len && write(symfd, symdone, len) != len)
+		error("symbol I/O");
+	symdone = nextsym;
 }
 
 static void write_symbol_table(void)
@@ -321,17 +476,15 @@ static void write_symbol_table(void)
 	unsigned len = (uint8_t *) nextsym - (uint8_t *) symbase;
 	uint8_t n[2];
 
-	/* FIXME: proper temporary file! */
-	int fd = open(symtab, O_WRONLY | O_CREAT | O_TRUNC, 0600);
-	if (fd == -1) {
-		perror(symtab);
-		exit(1);
-	}
+	sync_symbol_table();
+	/* The size is only a hint, the names are found by number */
+	if (len > 0xFFFF)
+		len = 0xFFFF;
 	n[0] = len;
 	n[1] = len >> 8;
-	if (write(fd, n, 2) != 2 || write(fd, symbase, len) != len)
+	if (lseek(symfd, 0L, SEEK_SET) < 0 || write(symfd, n, 2) != 2)
 		error("symbol I/O");
-	close(fd);
+	close(symfd);
 }
 
 /*
@@ -347,6 +500,7 @@ static void outbyte(unsigned char c)
 	*outptr++ = c;
 	if (outptr == outbuf + BLOCK) {
 		outptr = outbuf;
+		sync_symbol_table();
 		if (write(1, outbuf, BLOCK) != BLOCK)
 			error("I/O");
 	}
@@ -355,6 +509,7 @@ static void outbyte(unsigned char c)
 static void outflush(void)
 {
 	unsigned len = outptr - outbuf;
+	sync_symbol_table();
 	if (len && write(1, outbuf, len) != len)
 		error("I/O");
 }
@@ -369,44 +524,101 @@ static void outbyte_quoted(unsigned char c)
 		outbyte(c);
 }
 
-static unsigned char tokdata[8];
-static unsigned char *tokptr = tokdata;
+static char *doublesym = "+-=<>|&";
+static char *symeq = "+-/*^!|&%<>";
+static char *unibyte = TK_UNICHARS;
 
-static void encode_byte(unsigned c)
+static uint32_t tokval;		/* Value for a constant token */
+static unsigned char oldfile[33];
+
+static void outvarint(uint32_t n)
 {
-	*tokptr++ = c;
+	while (n >= 0x80) {
+		outbyte(n | 0x80);
+		n >>= 7;
+	}
+	outbyte(n);
 }
 
-static void write_token(unsigned c)
+static void write_line(void)
 {
 	unsigned char *tp;
-	unsigned n = 0;
-	if (oldline != line || filechange) {
-		oldline = line;
-		outbyte(T_LINE & 0xFF);
-		outbyte(T_LINE >> 8);
-		outbyte(line);
-		if (filechange) {
-			outbyte(0x80 | (line >> 8));
-			tp = filename;
-			while (*tp && n++ < 32)
-				outbyte(*tp++);
-			outbyte(0);
-		} else
-			outbyte(line >> 8);
-		filechange = 0;
+
+	/* cpp tells us the file name on every line marker so only send it
+	   if it really changed */
+	if (filechange && strcmp((char *)filename, (char *)oldfile)) {
+		strcpy((char *)oldfile, (char *)filename);
+		outbyte(TK_FILE);
+		outvarint(line);
+		tp = filename;
+		while (*tp)
+			outbyte(*tp++);
+		outbyte(0);
+	} else if (line > oldline && line - oldline <= 6)
+		outbyte(TK_NEXTLINE + line - oldline - 1);
+	else if (line != oldline) {
+		outbyte(TK_LINE);
+		if (line > oldline)
+			outvarint((line - oldline) << 1);
+		else
+			outvarint(((oldline - line) << 1) | 1);
 	}
+	oldline = line;
+	filechange = 0;
+}
+
+static void write_token(unsigned c)
+{
+	char *p;
+
+	if (oldline != line || filechange)
+		write_line();
 	/* Write the token, then any data for it */
-	outbyte(c);
-	outbyte(c >> 8);
-	tp = tokdata;
-	while (tp < tokptr)
-		outbyte(*tp++);
-	/* Reset the data pointer */
-	tokptr = tokdata;
+	if (c >= T_SYMBOL) {
+		c -= T_SYMBOL;
+		if (c < TK_NSYM1)
+			outbyte(TK_SYMBOL + c);
+		else if (c < TK_NSYM2) {
+			c -= TK_NSYM1;
+			outbyte(TK_SYMBOL2 + (c >> 8));
+			outbyte(c);
+		} else {
+			c += T_SYMBOL;
+			outbyte(TK_FULL);
+			outbyte(c);
+			outbyte(c >> 8);
+		}
+		return;
+	}
+	if (c < T_SHLEQ && (p = strchr(unibyte, c)) != NULL)
+		outbyte(TK_UNI + p - unibyte);
+	else if (c >= T_SHLEQ && c <= T_ELLIPSIS)
+		outbyte(TK_SPECIAL + c - T_SHLEQ);
+	else if (c >= T_PLUSPLUS && c <= T_ANDAND)
+		outbyte(TK_DOUBLESYM + c - T_PLUSPLUS);
+	else if (c >= T_PLUSEQ && c <= T_GTEQ)
+		outbyte(TK_SYMEQ + c - T_PLUSEQ);
+	else if (c >= T_KEYWORD && c <= T_RESTRICT)
+		outbyte(TK_KEYWORD + c - T_KEYWORD);
+	else if (c >= T_INTVAL && c <= T_STRING_END) {
+		outbyte(TK_VALUE + c - T_INTVAL);
+		if (c == T_FLOATVAL) {
+			outbyte(tokval);
+			outbyte(tokval >> 8);
+			outbyte(tokval >> 16);
+			outbyte(tokval >> 24);
+		} else if (c < T_FLOATVAL)
+			outvarint(tokval);
+	} else if (c == T_EOF)
+		outbyte(TK_EOF);
+	else {
+		outbyte(TK_FULL);
+		outbyte(c);
+		outbyte(c >> 8);
+	}
 }
 
-/* C keywords, ignoring all the modern crap */
+/* C keywords, ignoring all the modern crap. In token order */
 
 static const char *keytab[] = {
 	/* Types */
@@ -450,20 +662,101 @@ static const char *keytab[] = {
 	NULL
 };
 
-/* Add keywords. These get added first so they head the hash lists */
-static void keywords(void)
+/*
+ *	Keywords are not kept in the symbol table. The first letter and the
+ *	length, and sometimes another letter, leave only one keyword a name
+ *	can be so we just check that one.
+ */
+static unsigned keyword(const char *s, unsigned len)
 {
-	const char **p = keytab;
-	int i = T_KEYWORD;
-	while (*p) {
-		new_symbol(*p, hash_symbol(*p), i++);
-		p++;
+	unsigned t;
+
+	if (len < 2 || len > 8)
+		return 0;
+	switch (*s) {
+	case 'a':
+		t = T_AUTO;
+		break;
+	case 'b':
+		t = T_BREAK;
+		break;
+	case 'c':
+		if (len == 4)
+			t = s[1] == 'h' ? T_CHAR : T_CASE;
+		else
+			t = len == 5 ? T_CONST : T_CONTINUE;
+		break;
+	case 'd':
+		if (len == 2)
+			t = T_DO;
+		else
+			t = len == 6 ? T_DOUBLE : T_DEFAULT;
+		break;
+	case 'e':
+		if (len == 6)
+			t = T_EXTERN;
+		else
+			t = s[1] == 'n' ? T_ENUM : T_ELSE;
+		break;
+	case 'f':
+		t = len == 3 ? T_FOR : T_FLOAT;
+		break;
+	case 'g':
+		t = T_GOTO;
+		break;
+	case 'i':
+		t = len == 2 ? T_IF : T_INT;
+		break;
+	case 'l':
+		t = T_LONG;
+		break;
+	case 'r':
+		if (len == 6)
+			t = T_RETURN;
+		else
+			t = s[2] == 'g' ? T_REGISTER : T_RESTRICT;
+		break;
+	case 's':
+		if (len == 5)
+			t = T_SHORT;
+		else if (s[1] == 'i')
+			t = s[2] == 'g' ? T_SIGNED : T_SIZEOF;
+		else if (s[1] == 't')
+			t = s[2] == 'r' ? T_STRUCT : T_STATIC;
+		else
+			t = T_SWITCH;
+		break;
+	case 't':
+		t = T_TYPEDEF;
+		break;
+	case 'u':
+		t = len == 5 ? T_UNION : T_UNSIGNED;
+		break;
+	case 'v':
+		t = len == 4 ? T_VOID : T_VOLATILE;
+		break;
+	case 'w':
+		t = T_WHILE;
+		break;
+	default:
+		return 0;
 	}
+	if (strcmp(s, keytab[t - T_KEYWORD]))
+		return 0;
+	return t;
+}
+
+static void init_symbols(void)
+{
+#if defined(__linux__)
+	grow_symbols();
+#endif
 	symbase = nextsym;
 }
 
-/* Read up to 14 more bytes into the symbol name, plus a terminator */
-static void get_symbol_tail(char *p)
+/* Read up to 14 more bytes into the symbol name, plus a terminator.
+   Returns the length we kept */
+static unsigned get_symbol_tail(char *p)
 {
 	unsigned n = 14;
 	unsigned c;
@@ -477,6 +770,7 @@ static void get_symbol_tail(char *p)
 	}
 	*p = 0;
 	unget(c);
+	return 14 - n;
 }
 
 /* Also does keywords */
@@ -486,13 +780,21 @@ static unsigned tokenize_symbol(unsigned c)
 	unsigned h;
 	struct name *s;
 	*symstr = c;
-	get_symbol_tail(symstr + 1);
+	h = get_symbol_tail(symstr + 1) + 1;
+	h = keyword(symstr, h);
+	if (h)
+		return h;
 	/* We can't do cunning tricks to spot labels in this pass because
 	   foo: is ambiguous between a label and a ?: */
 	h = hash_symbol(symstr);
 	s = find_symbol(symstr, h);
 	if (s)
 		return s->id;
+#if defined(__linux__)
+	/* Token numbers are 16bit */
+	if (symnum > 0xFFFF)
+		fatal("too many symbols");
+#endif
 	return new_symbol(symstr, h, symnum++)->id;
 }
 
@@ -918,12 +1220,7 @@ static unsigned tokenize_numeric(unsigned c, unsigned neg)
 		else
 			result = -result;
 	}
-	/* Order really doesn't matter here so stick to LE. We will worry about 
-	   actual byte order in the code generation */
-	encode_byte(result);
-	encode_byte(result >> 8);
-	encode_byte(result >> 16);
-	encode_byte(result >> 24);
+	tokval = result;
 	return rtype;
 }
 
@@ -1013,10 +1310,7 @@ static unsigned tokenize_char(void)
 	unsigned c2;
 	if (c != '\\') {
 		/* Encode as a value */
-		encode_byte(c);
-		encode_byte(0);
-		encode_byte(0);
-		encode_byte(0);
+		tokval = c;
 		c = get();
 		if (c != '`') {
 			unget(c);
@@ -1029,12 +1323,9 @@ static unsigned tokenize_char(void)
 	required('\'');
 	if (c == T_INVALID)
 		/* Not a valid escape */
-		encode_byte(c2);
+		tokval = c2;
 	else
-		encode_byte(c);
-	encode_byte(0);
-	encode_byte(0);
-	encode_byte(0);
+		tokval = c;
 	return T_INTVAL;
 }
 
@@ -1067,9 +1358,6 @@ static unsigned tokenize_string(void)
 	return T_STRING_END;
 }
 
-static char *doublesym = "+-=<>|&";
-static char *symeq = "+-/*^!|&%<>";
-static char *unibyte = "()[]{}&*/%+-?:^<>|~!=;.,";
 
 static unsigned tokenize(void)
 {
@@ -1144,14 +1432,51 @@ static unsigned tokenize(void)
 	return T_POT;
 }
 
-/* Tokenizer as a standalone pass */
+/* Tokenizer as a standalone pass
+   cc0 [-Idir] [-Dname[=value]] [-Uname] symtab [file.c]
+   Given a source file we preprocess it ourselves, otherwise we read cpp
+   output on stdin */
 int main(int argc, char *argv[])
 {
 	unsigned t;
+	unsigned opt;
+	char *p;
+
+	while (argv[1] && argv[1][0] == '-') {
+		argv++;
+		opt = argv[0][1];
+		p = argv[0] + 2;
+		if (*p == 0 && argv[1])
+			p = *++argv;
+		switch (opt) {
+		case 'I':
+			pp_include_dir(p);
+			break;
+		case 'D':
+			pp_define(p);
+			break;
+		case 'U':
+			pp_undef(p);
+			break;
+		default:
+			fatal("unknown option");
+		}
+	}
 	symtab = argv[1];
 	if (symtab == NULL)
 		symtab = ".symtab";
-	keywords();
+	init_symbols();
+	open_symbol_table();
+	if (argv[1] && argv[2]) {
+		pp_open(argv[2]);
+		preprocess = 1;
+	}
+#ifdef BIGIO
+	else
+		map_input();
+#endif
+	outbyte(TK_MAGIC);
+	outbyte(TK_VERSION);
 	do {
 		t = tokenize();
 		write_token(t);
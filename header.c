@@ -30,6 +30,7 @@ void rewrite_header(unsigned long pos, unsigned htype, unsigned name, unsigned d
 	out_seek(pos);
 	header(htype, name, data);
 	out_seek(curr);
+	out_release();
 }
 
 unsigned long mark_header(void)
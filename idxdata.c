@@ -11,6 +11,20 @@
 
 #include "compiler.h"
 
+#ifdef ARENA
+
+/* Index data describes types so it lives for the whole run */
+static struct arena idx_arena = {
+    NULL, NULL, NULL, NULL, IDX_SIZE * sizeof(unsigned)
+};
+
+unsigned *idx_get(unsigned len)
+{
+    return arena_alloc(&idx_arena, len * sizeof(unsigned));
+}
+
+#else
+
 static unsigned idxmem[IDX_SIZE];
 static unsigned *idxptr = idxmem;
 /*
@@ -27,9 +41,45 @@ unsigned *idx_get(unsigned len)
     return p;
 }
 
+#endif
+
 unsigned *idx_copy(unsigned *p, unsigned n)
 {
     unsigned *r = idx_get(n);
     memcpy(r, p, n * sizeof(unsigned));
     return r;
 }
+
+/*
+ *	Function argument lists and array dimensions are never changed once
+ *	made, so we keep just one copy of each shape. The words in front of
+ *	each hold the next on its hash chain. Two types are then the same
+ *	shape exactly when their vectors are the same pointer. The first word
+ *	is the count so the length is *p + 1.
+ */
+#define NIDXHASH	64
+#define LINKWORDS	((sizeof(unsigned *) + sizeof(unsigned) - 1) / sizeof(unsigned))
+
+static unsigned *idxhash[NIDXHASH];
+
+unsigned *idx_find(unsigned *p)
+{
+    unsigned n = *p + 1;
+    unsigned h = 0;
+    unsigned i;
+    unsigned *r;
+
+    for (i = 0; i < n; i++)
+        h = h * 7 + p[i];
+    h &= NIDXHASH - 1;
+    for (r = idxhash[h]; r; memcpy(&r, r - LINKWORDS, sizeof(r))) {
+        if (*r == *p && memcmp(r, p, n * sizeof(unsigned)) == 0)
+            return r;
+    }
+    r = idx_get(n + LINKWORDS);
+    memcpy(r, &idxhash[h], sizeof(r));
+    r += LINKWORDS;
+    idxhash[h] = r;
+    memcpy(r, p, n * sizeof(unsigned));
+    return r;
+}
@@ -1,2 +1,3 @@
 extern unsigned *idx_get(unsigned len);
 extern unsigned *idx_copy(unsigned *from, unsigned len);
+extern unsigned *idx_find(unsigned *p);
@@ -1,6 +1,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include "compiler.h"
 
 /*
@@ -39,14 +40,130 @@ static int in_byte(void)
 	return EOF;
 }
 
+#ifdef BIGIO
+
+/*
+ *	On a hosted system the output is gathered in memory and written in
+ *	large blocks. Nothing is written while a header is waiting to be
+ *	rewritten, so the fixup is made in the buffer and we never seek back.
+ *	That also means the output can be a pipe.
+ */
+#define BLOCK	65536
+
+static unsigned char *outbuf;
+static unsigned outsize;
+static unsigned outlen;		/* Bytes in the buffer */
+static unsigned outpos;		/* Where the next byte goes */
+static unsigned holding;	/* A header position is outstanding */
+
+void out_write(void)
+{
+	if (outlen && write(1, outbuf, outlen) != outlen)
+		fatal("write error");
+	outlen = outpos = 0;
+}
+
+/* Write out what we have once there is a good sized block of it */
+void out_flush(void)
+{
+	if (!holding && outlen >= BLOCK)
+		out_write();
+}
+
+/* Positions are offsets into the buffer, which stays put while held */
+unsigned long out_tell(void)
+{
+	holding = 1;
+	return outpos;
+}
+
+void out_seek(unsigned long pos)
+{
+	outpos = pos;
+}
+
+void out_release(void)
+{
+	holding = 0;
+	out_flush();
+}
+
+void out_block(void *pv, unsigned len)
+{
+	out_flush();
+	if (outpos + len > outsize) {
+		outsize = 2 * outsize + len + BLOCK;
+		outbuf = realloc(outbuf, outsize);
+		if (outbuf == NULL)
+			fatal("out of memory");
+	}
+	memcpy(outbuf + outpos, pv, len);
+	outpos += len;
+	if (outpos > outlen)
+		outlen = outpos;
+}
+
+void out_byte(unsigned char c)
+{
+	if (outpos == outsize || outlen >= BLOCK) {
+		out_block(&c, 1);
+		return;
+	}
+	outbuf[outpos++] = c;
+	if (outpos > outlen)
+		outlen = outpos;
+}
+
+#else
+
 static unsigned char outbuf[128];
 static unsigned char *outptr = outbuf;
 static unsigned int outlen;
 static unsigned int outrecord = 0;
 
+/*
+ *	If we are writing into a pipe we cannot go back and rewrite a header.
+ *	Instead everything from the point we are asked to remember up until
+ *	the header is rewritten is held in memory, patched there and then
+ *	written out.
+ */
+static int out_seekable = -1;
+static unsigned char *holdbuf;
+static unsigned holdsize;
+static unsigned holdlen;
+static unsigned holdpos;
+static unsigned holding;
+
+static unsigned out_can_seek(void)
+{
+	if (out_seekable == -1) {
+		out_seekable = 1;
+		if (lseek(1, 0L, SEEK_CUR) < 0) {
+			if (errno != ESPIPE)
+				fatal("seek error");
+			out_seekable = 0;
+		}
+	}
+	return out_seekable;
+}
+
+static void hold_block(unsigned char *p, unsigned len)
+{
+	if (holdpos + len > holdsize) {
+		holdsize = 2 * holdsize + len + 512;
+		holdbuf = realloc(holdbuf, holdsize);
+		if (holdbuf == NULL)
+			fatal("out of memory");
+	}
+	memcpy(holdbuf + holdpos, p, len);
+	holdpos += len;
+	if (holdpos > holdlen)
+		holdlen = holdpos;
+}
+
 void out_write(void)
 {
-	if (lseek(1, outrecord * 128L, SEEK_SET) < 0)
+	if (out_can_seek() && lseek(1, outrecord * 128L, SEEK_SET) < 0)
 		fatal("seek error");
 	if (outlen && write(1, outbuf, outlen) != outlen)
 		fatal("write error");
@@ -72,24 +189,49 @@ static void out_record_read(unsigned record)
 	outrecord = record;
 }
 
-/* Report the current record/offset */
+/* Report the current record/offset. On a pipe this starts holding the
+   output so that we can come back to it */
 unsigned long out_tell(void)
 {
+	if (!out_can_seek()) {
+		if (!holding) {
+			holding = 1;
+			holdpos = holdlen = 0;
+		}
+		return holdpos;
+	}
 	return (outrecord << 8) | outlen;
 }
 
 /* Go to a given record/offset from before */
 void out_seek(unsigned long pos)
 {
+	if (holding) {
+		holdpos = pos;
+		return;
+	}
 	out_write();
 	out_record_read(pos >> 8);
 	outlen = pos & 0xFF;
 	outptr = outbuf + outlen;
 }
 
+/* We are done going back: write out anything we were holding */
+void out_release(void)
+{
+	if (holding) {
+		holding = 0;
+		out_block(holdbuf, holdlen);
+	}
+}
+
 /* Add bytes at the current position */
 void out_byte(unsigned char c)
 {
+	if (holding) {
+		hold_block(&c, 1);
+		return;
+	}
 	if (outlen == 128)
 		out_flush();
 	*outptr++ = c;
@@ -99,6 +241,10 @@ void out_byte(unsigned char c)
 void out_block(void *pv, unsigned len)
 {
 	unsigned char *p = pv;
+	if (holding) {
+		hold_block(p, len);
+		return;
+	}
 	while(len) {
 		unsigned n;
 
@@ -117,6 +263,8 @@ void out_block(void *pv, unsigned len)
 	}
 }
 
+#endif
+
 char filename[33];
 
 unsigned line_num;
@@ -135,9 +283,40 @@ unsigned tokbyte(void)
 	return c;
 }
 
+static unsigned long tokvarint(void)
+{
+	unsigned long n = 0;
+	unsigned shift = 0;
+	unsigned c;
+
+	do {
+		if (shift > 28) {
+			error("corrupt stream");
+			exit(1);
+		}
+		c = tokbyte();
+		n |= (unsigned long)(c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return n;
+}
+
+/* Check the stream is in the encoding we understand (see token.h) */
+void init_tokens(void)
+{
+	if (in_byte() != TK_MAGIC || in_byte() != TK_VERSION) {
+		error("token stream version");
+		exit(1);
+	}
+}
+
+static const char unitok[] = TK_UNICHARS;
+
 void next_token(void)
 {
 	int c;
+	unsigned long n;
+	char *p;
 
 	/* Handle pushed back tokens */
 	if (last_token != NO_TOKEN) {
@@ -146,47 +325,67 @@ void next_token(void)
 		return;
 	}
 
-	c = in_byte();
-	if (c == EOF) {
-		token = T_EOF;
-//        printf("*** EOF\n");
-		return;
-	}
-	token = c;
-	c = in_byte();
-	if (c == EOF) {
-		token = T_EOF;
-		return;
-	}
-	token |= (c << 8);
-
-	if (token == T_LINE) {
-		char *p = filename;
-
-		line_num = tokbyte();
-		line_num |= tokbyte() << 8;
-
-		if (line_num & 0x8000) {
-			line_num &= 0x7FFF;
-			for (c = 0; c < 32; c++) {
-				*p = tokbyte();
-				if (*p == 0)
-					break;
-				p++;
-			}
+	while (1) {
+		c = in_byte();
+		if (c == EOF || c == TK_EOF) {
+			token = T_EOF;
+			return;
+		}
+		if (c >= TK_SYMBOL2) {
+			token = T_SYMBOL + TK_NSYM1 + ((c - TK_SYMBOL2) << 8);
+			token += tokbyte();
+			return;
+		}
+		if (c >= TK_SYMBOL) {
+			token = T_SYMBOL + c - TK_SYMBOL;
+			return;
+		}
+		if (c >= TK_NEXTLINE) {
+			line_num += c - TK_NEXTLINE + 1;
+			continue;
+		}
+		if (c == TK_LINE) {
+			n = tokvarint();
+			if (n & 1)
+				line_num -= n >> 1;
+			else
+				line_num += n >> 1;
+			continue;
+		}
+		if (c == TK_FILE) {
+			line_num = tokvarint();
+			p = filename;
+			while ((c = tokbyte()) != 0)
+				if (p < filename + 32)
+					*p++ = c;
 			*p = 0;
+			continue;
 		}
-		next_token();
-		return;
+		break;
 	}
 
-	if (token == T_INTVAL || token == T_LONGVAL || token == T_UINTVAL
-	    || token == T_ULONGVAL || token == T_FLOATVAL) {
-		token_value = tokbyte();
-		token_value |= tokbyte() << 8;
-		token_value |= tokbyte() << 16;
-		token_value |= tokbyte() << 24;
-	}
+	if (c == TK_FULL) {
+		token = tokbyte();
+		token |= tokbyte() << 8;
+	} else if (c >= TK_KEYWORD)
+		token = T_KEYWORD + c - TK_KEYWORD;
+	else if (c >= TK_VALUE) {
+		token = T_INTVAL + c - TK_VALUE;
+		if (token == T_FLOATVAL) {
+			token_value = tokbyte();
+			token_value |= tokbyte() << 8;
+			token_value |= (unsigned long)tokbyte() << 16;
+			token_value |= (unsigned long)tokbyte() << 24;
+		} else if (token < T_FLOATVAL)
+			token_value = tokvarint();
+	} else if (c >= TK_SYMEQ)
+		token = T_PLUSEQ + c - TK_SYMEQ;
+	else if (c >= TK_DOUBLESYM)
+		token = T_PLUSPLUS + c - TK_DOUBLESYM;
+	else if (c >= TK_SPECIAL)
+		token = T_SHLEQ + c - TK_SPECIAL;
+	else
+		token = unitok[c - TK_UNI];
 }
 
 /*
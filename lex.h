@@ -5,6 +5,7 @@ extern char filename[33];
 
 extern unsigned label_tag;
 
+extern void init_tokens(void);
 extern void next_token(void);
 extern void push_token(unsigned);
 extern unsigned match(unsigned);
@@ -21,5 +22,6 @@ extern void out_write(void);
 extern void out_flush(void);
 extern unsigned long out_tell(void);
 extern void out_seek(unsigned long pos);
+extern void out_release(void);
 extern void out_byte(unsigned char c);
 extern void out_block(void *pv, unsigned len);
@@ -38,10 +38,13 @@ static unsigned functype[2] = {
 
 int main(int argc, char *argv[])
 {
+	init_tokens();
 	next_token();
 	init_nodes();
+	out_block("%V", 2);
+	out_byte(TREE_VERSION);
 	/* A function with no type info returning INT */
-	deffunctype = make_function(CINT, functype);
+	deffunctype = make_function(CINT, idx_find(functype));
 #ifdef DEBUG
 	if (argv[1]) {
 		debug = fopen(argv[1], "w");
@@ -0,0 +1,1693 @@
+/*
+ *	Integrated preprocessor
+ *
+ *	When cc0 is given a source file rather than cpp output it does the
+ *	preprocessing itself. We produce the same text cpp would, line
+ *	markers and all, and hand it to the tokenizer a buffer at a time, so
+ *	there is no cpp process and no .% file or pipe between the two.
+ *
+ *	Macros are expanded on the text using a stack of inputs. Each
+ *	expansion is pushed with its macro marked busy, and the macro is
+ *	free for use again once that input has been read. A name met while
+ *	its macro is busy is marked so that it is never expanded later on,
+ *	as the standard requires when the text is rescanned.
+ *
+ *	Headers wrapped in #ifndef X ... #endif, or marked #pragma once, are
+ *	remembered so that later includes of them are skipped without even
+ *	opening the file.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+
+#include "preproc.h"
+
+#define MAXINCLUDE	32		/* Nesting of includes */
+#define MAXIF		64		/* Nesting of conditionals */
+#define MAXPARAM	64		/* Parameters to a macro */
+#define NMHASH		256
+
+/* Markers in macro bodies. P_ARG and P_STR are followed by the parameter
+   number plus one */
+#define P_ARG		1
+#define P_STR		2
+#define P_PASTE		3
+
+/* Markers in expanded text. P_PAD keeps an expansion from being glued to
+   the tokens around it and is a space by the time it is output. P_NOEXP
+   comes before a name that must not be expanded again */
+#define P_PAD		4
+#define P_NOEXP		5
+
+struct buf {
+	char *p;
+	unsigned len;
+	unsigned size;
+};
+
+struct macro {
+	struct macro *next;
+	char *body;
+	int nparam;		/* -1 if not a function like macro */
+	unsigned char variadic;
+	unsigned char busy;	/* Being expanded */
+	unsigned char special;	/* __FILE__ or __LINE__ */
+	char name[1];
+};
+
+#define M_FILE		1
+#define M_LINE		2
+
+struct file {
+	struct file *prev;
+	char *path;		/* As opened, for finding "" includes */
+	char *name;		/* As reported, can be changed by #line */
+	char *buf;
+	char *ptr;
+	char *end;
+	unsigned line;		/* Line number at ptr */
+	unsigned dir;		/* Search directory it came from plus one */
+	unsigned ifbase;	/* Conditional depth when we started */
+	char *guard;		/* Include guard macro if it has one */
+	unsigned gstate;
+};
+
+#define G_START		0	/* Nothing seen yet */
+#define G_IN		1	/* Inside the #ifndef of a possible guard */
+#define G_END		2	/* Seen the #endif for it */
+#define G_NONE		3	/* Not a guarded header */
+
+/* Headers we can skip. The guard is NULL for #pragma once */
+struct skip {
+	struct skip *next;
+	char *guard;
+	char path[1];
+};
+
+/* Macro expansion works on a stack of inputs */
+struct input {
+	struct input *prev;
+	char *text;		/* Allocated text or NULL */
+	char *ptr;
+	struct macro *m;	/* Macro to free up when done */
+};
+
+#define IF_TRUE		0	/* Processing this part */
+#define IF_FALSE	1	/* Looking for a part to process */
+#define IF_DONE		2	/* Done a part, skipping the rest */
+#define IF_ELSE		4	/* Seen the #else */
+
+static struct macro *mhash[NMHASH];
+static struct skip *skiplist;
+static struct file *cur;
+static unsigned depth;
+static unsigned curline;	/* Line the current logical line began */
+
+static unsigned char ifstack[MAXIF];
+static unsigned ifdepth;
+
+static struct buf lbuf;		/* Current logical line */
+static unsigned pending;	/* lbuf holds a line we read ahead */
+static struct buf name;
+static struct buf pathbuf;
+
+static struct input *in;
+static unsigned line_mode;	/* Calls may run on into following lines */
+static struct buf obuf;		/* Text waiting for the tokenizer */
+static unsigned opos;
+static struct buf *out = &obuf;	/* Where expansion is going */
+static struct file *ofile;	/* Where the tokenizer thinks it is */
+static unsigned oline;
+
+static char *incdir[MAXINCLUDE];
+static unsigned nincdir;
+
+static void pp_error(const char *p)
+{
+	error_at(cur ? cur->name : "<command line>", curline, p);
+}
+
+static void pp_fatal(const char *p)
+{
+	pp_error(p);
+	exit(1);
+}
+
+static char msgbuf[160];
+
+static const char *msg(const char *a, const char *b)
+{
+	strncpy(msgbuf, a, 100);
+	msgbuf[100] = 0;
+	strcat(msgbuf, b);
+	return msgbuf;
+}
+
+static void *xrealloc(void *p, unsigned n)
+{
+	p = realloc(p, n);
+	if (p == NULL)
+		pp_fatal("out of memory");
+	return p;
+}
+
+static char *xstrdup(const char *s, unsigned len)
+{
+	char *p = xrealloc(NULL, len + 1);
+	memcpy(p, s, len);
+	p[len] = 0;
+	return p;
+}
+
+static void bputc(struct buf *b, int c)
+{
+	if (b->len == b->size) {
+		b->size = b->size ? 2 * b->size : 128;
+		b->p = xrealloc(b->p, b->size);
+	}
+	b->p[b->len++] = c;
+}
+
+static void bputs(struct buf *b, const char *s, unsigned len)
+{
+	while (len--)
+		bputc(b, *s++);
+}
+
+/* Terminate the text without counting the 0 in the length */
+static char *bterm(struct buf *b)
+{
+	bputc(b, 0);
+	b->len--;
+	return b->p;
+}
+
+static int isident(int c)
+{
+	return c == '_' || isalnum(c);
+}
+
+static int isidstart(int c)
+{
+	return c == '_' || isalpha(c);
+}
+
+static unsigned identlen(const char *p)
+{
+	const char *s = p;
+	if (!isidstart((unsigned char)*p))
+		return 0;
+	while (isident((unsigned char)*p))
+		p++;
+	return p - s;
+}
+
+static unsigned isword(const char *p, unsigned len, const char *w)
+{
+	return strlen(w) == len && memcmp(p, w, len) == 0;
+}
+
+static char *skipws(char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\f' || *p == '\v')
+		p++;
+	return p;
+}
+
+/* Copy a pp-number so we don't go looking for names in 10UL or 1e5 */
+static char *copy_number(struct buf *b, char *p)
+{
+	int l = 0;
+	while (isident((unsigned char)*p) || *p == '.' ||
+		((*p == '+' || *p == '-') && (l == 'e' || l == 'E' || l == 'p' || l == 'P'))) {
+		l = *p++;
+		bputc(b, l);
+	}
+	return p;
+}
+
+/* Copy a string or character literal */
+static char *copy_quoted(struct buf *b, char *p)
+{
+	int q = *p++;
+	bputc(b, q);
+	while (*p && *p != '\n') {
+		bputc(b, *p);
+		if (*p == '\\' && p[1]) {
+			bputc(b, *++p);
+		} else if (*p == q) {
+			p++;
+			break;
+		}
+		p++;
+	}
+	return p;
+}
+
+/*
+ *	Macro table
+ */
+
+static struct macro **mfind(const char *s, unsigned len)
+{
+	struct macro **mp;
+	unsigned h = 0;
+	unsigned n;
+
+	for (n = 0; n < len; n++)
+		h = h * 31 + (unsigned char)s[n];
+	mp = &mhash[h & (NMHASH - 1)];
+	while (*mp) {
+		if (strncmp((*mp)->name, s, len) == 0 && (*mp)->name[len] == 0)
+			break;
+		mp = &(*mp)->next;
+	}
+	return mp;
+}
+
+static struct macro *lookup(const char *s, unsigned len)
+{
+	return *mfind(s, len);
+}
+
+static void undefine(const char *s, unsigned len)
+{
+	struct macro **mp = mfind(s, len);
+	struct macro *m = *mp;
+	if (m) {
+		*mp = m->next;
+		free(m->body);
+		free(m);
+	}
+}
+
+static struct macro *new_macro(const char *s, unsigned len, char *body, int nparam)
+{
+	struct macro **mp = mfind(s, len);
+	struct macro *m = *mp;
+
+	if (m) {
+		if (m->nparam != nparam || strcmp(m->body, body))
+			warning_at(cur ? cur->name : "<command line>", curline,
+				msg(m->name, ": macro redefined"));
+		free(m->body);
+	} else {
+		m = xrealloc(NULL, sizeof(struct macro) + len);
+		memcpy(m->name, s, len);
+		m->name[len] = 0;
+		m->next = NULL;
+		m->busy = 0;
+		m->special = 0;
+		*mp = m;
+	}
+	m->body = body;
+	m->nparam = nparam;
+	m->variadic = 0;
+	return m;
+}
+
+static char *pname[MAXPARAM];
+static unsigned plen[MAXPARAM];
+
+static int param(const char *p, unsigned len, int np)
+{
+	int i;
+	for (i = 0; i < np; i++)
+		if (plen[i] == len && memcmp(pname[i], p, len) == 0)
+			return i;
+	return -1;
+}
+
+/* #define name(params) body. The body is kept with the parameters and
+   operators turned into markers and the white space squashed */
+static void do_define(char *p)
+{
+	struct buf b;
+	struct macro *m;
+	char *s = p;
+	char *q;
+	unsigned len = identlen(p);
+	unsigned l;
+	int np = -1;
+	int n;
+	unsigned variadic = 0;
+
+	if (len == 0) {
+		pp_error("bad macro name");
+		return;
+	}
+	p += len;
+	if (*p == '(') {
+		np = 0;
+		p = skipws(p + 1);
+		while (*p != ')') {
+			if (np == MAXPARAM) {
+				pp_error("too many macro parameters");
+				return;
+			}
+			if (memcmp(p, "...", 3) == 0) {
+				pname[np] = (char *)"__VA_ARGS__";
+				plen[np++] = 11;
+				variadic = 1;
+				p = skipws(p + 3);
+				break;
+			}
+			l = identlen(p);
+			if (l == 0) {
+				pp_error("bad macro parameters");
+				return;
+			}
+			pname[np] = p;
+			plen[np++] = l;
+			p = skipws(p + l);
+			/* The GNU name... form */
+			if (memcmp(p, "...", 3) == 0) {
+				variadic = 1;
+				p = skipws(p + 3);
+				break;
+			}
+			if (*p != ',')
+				break;
+			p = skipws(p + 1);
+		}
+		if (*p != ')') {
+			pp_error("bad macro parameters");
+			return;
+		}
+		p++;
+	}
+	memset(&b, 0, sizeof(b));
+	p = skipws(p);
+	while (*p) {
+		if (isspace((unsigned char)*p)) {
+			while (isspace((unsigned char)*p))
+				p++;
+			if (*p)
+				bputc(&b, ' ');
+		} else if (*p == '"' || *p == '\'')
+			p = copy_quoted(&b, p);
+		else if (isdigit((unsigned char)*p))
+			p = copy_number(&b, p);
+		else if (*p == '#' && p[1] == '#') {
+			while (b.len && b.p[b.len - 1] == ' ')
+				b.len--;
+			bputc(&b, P_PASTE);
+			p = skipws(p + 2);
+		} else if (*p == '#' && np >= 0) {
+			q = skipws(p + 1);
+			l = identlen(q);
+			n = param(q, l, np);
+			if (n < 0) {
+				pp_error("'#' is not followed by a macro parameter");
+				bputc(&b, *p++);
+			} else {
+				bputc(&b, P_STR);
+				bputc(&b, n + 1);
+				p = q + l;
+			}
+		} else if ((l = identlen(p)) != 0) {
+			n = param(p, l, np);
+			if (n >= 0) {
+				bputc(&b, P_ARG);
+				bputc(&b, n + 1);
+			} else
+				bputs(&b, p, l);
+			p += l;
+		} else
+			bputc(&b, *p++);
+	}
+	m = new_macro(s, len, xstrdup(b.len ? b.p : "", b.len), np);
+	m->variadic = variadic;
+	free(b.p);
+}
+
+/*
+ *	Expansion
+ */
+
+static void push_input(char *text, struct macro *m)
+{
+	struct input *i = xrealloc(NULL, sizeof(struct input));
+	i->prev = in;
+	i->text = text;
+	i->ptr = text;
+	i->m = m;
+	if (m)
+		m->busy = 1;
+	in = i;
+}
+
+static void pop_input(void)
+{
+	struct input *i = in;
+	in = i->prev;
+	if (i->m)
+		i->m->busy = 0;
+	free(i->text);
+	free(i);
+}
+
+static unsigned read_line(void);
+
+/* A macro call can run on over following lines. Fetch the next one into
+   the bottom input unless it is a directive, which we leave to be dealt
+   with as usual */
+static unsigned refill(void)
+{
+	if (!line_mode || pending || !read_line())
+		return 0;
+	if (*skipws(lbuf.p) == '#') {
+		pending = 1;
+		in->ptr = (char *)"";
+		return 0;
+	}
+	if (cur->gstate != G_IN)
+		cur->gstate = G_NONE;
+	in->ptr = lbuf.p;
+	return 1;
+}
+
+/* Look at the next character, or 0 if the input has run out */
+static int peekc(unsigned more)
+{
+	while (*in->ptr == 0) {
+		if (in->prev)
+			pop_input();
+		else if (!more || !refill())
+			return 0;
+	}
+	return (unsigned char)*in->ptr;
+}
+
+static int getc_in(unsigned more)
+{
+	int c = peekc(more);
+	if (c)
+		in->ptr++;
+	return c;
+}
+
+static void outc(int c)
+{
+	if (out == &obuf) {
+		if (c == P_NOEXP)
+			return;
+		if (c == P_PAD)
+			c = ' ';
+	}
+	bputc(out, c);
+}
+
+static void outs(const char *s, unsigned len)
+{
+	bputs(out, s, len);
+}
+
+static void outnum(unsigned long n)
+{
+	char b[12];
+	char *p = b + 12;
+	do {
+		*--p = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	outs(p, b + 12 - p);
+}
+
+static void outname(const char *s)
+{
+	outc('"');
+	while (*s) {
+		if (*s == '"' || *s == '\\')
+			outc('\\');
+		outc(*s++);
+	}
+	outc('"');
+}
+
+static void scan(void);
+
+/* Fully expand some text on its own, as is done for macro arguments */
+static char *expand_text(const char *s)
+{
+	struct input *save = in;
+	struct buf *saveout = out;
+	unsigned savemode = line_mode;
+	struct buf b;
+
+	memset(&b, 0, sizeof(b));
+	in = NULL;
+	push_input(xstrdup(s, strlen(s)), NULL);
+	out = &b;
+	line_mode = 0;
+	scan();
+	pop_input();
+	in = save;
+	out = saveout;
+	line_mode = savemode;
+	return bterm(&b);
+}
+
+/* The same for a directive that wants plain text back */
+static char *expand_line(const char *s)
+{
+	char *e = expand_text(s);
+	char *p = e;
+	char *q = e;
+
+	while (*p) {
+		if (*p == P_PAD)
+			*q++ = ' ';
+		else if (*p != P_NOEXP)
+			*q++ = *p;
+		p++;
+	}
+	*q = 0;
+	return e;
+}
+
+/* Every " and \ in a literal is escaped, and the string itself closes
+   on the quote that ends it, not on any escaped one inside */
+static void stringize(struct buf *b, const char *s)
+{
+	int q = 0;
+	int c;
+
+	bputc(b, '"');
+	while ((c = *s++) != 0) {
+		if (c == P_PAD || c == P_NOEXP)
+			continue;
+		if (q) {
+			if (c == '"' || c == '\\')
+				bputc(b, '\\');
+			bputc(b, c);
+			if (c == '\\' && *s) {
+				c = *s++;
+				if (c == '"' || c == '\\')
+					bputc(b, '\\');
+				bputc(b, c);
+			} else if (c == q)
+				q = 0;
+		} else if (isspace(c)) {
+			while (isspace((unsigned char)*s) || *s == P_PAD)
+				s++;
+			bputc(b, ' ');
+		} else {
+			if (c == '"' || c == '\'') {
+				q = c;
+				if (c == '"')
+					bputc(b, '\\');
+			}
+			bputc(b, c);
+		}
+	}
+	bputc(b, '"');
+}
+
+static void free_args(char **args, unsigned n)
+{
+	while (n)
+		free(args[--n]);
+	free(args);
+}
+
+/* Collect the arguments to a call, the ( has been read */
+static char **collect_args(struct macro *m, unsigned *np)
+{
+	struct buf a;
+	char **args;
+	unsigned max = m->nparam ? m->nparam : 1;
+	unsigned n = 0;
+	unsigned level = 0;
+	int c, q;
+
+	args = xrealloc(NULL, sizeof(char *) * max);
+	memset(&a, 0, sizeof(a));
+	while (1) {
+		c = getc_in(line_mode);
+		if (c == 0) {
+			pp_error(msg(m->name, ": unterminated macro call"));
+			free_args(args, n < max ? n : max);
+			free(a.p);
+			return NULL;
+		}
+		if (c == '"' || c == '\'') {
+			bputc(&a, c);
+			q = c;
+			while ((c = getc_in(0)) != 0 && c != '\n') {
+				bputc(&a, c);
+				if (c == '\\' && (c = getc_in(0)) != 0)
+					bputc(&a, c);
+				else if (c == q)
+					break;
+			}
+			continue;
+		}
+		if (c == '(')
+			level++;
+		else if ((c == ')' && level-- == 0) || (c == ',' && level == 0 &&
+				!(m->variadic && n == max - 1))) {
+			/* End of an argument */
+			while (a.len && (isspace((unsigned char)a.p[a.len - 1]) ||
+					a.p[a.len - 1] == P_PAD))
+				a.len--;
+			if (n < max)
+				args[n] = xstrdup(a.len ? a.p : "", a.len);
+			n++;
+			a.len = 0;
+			if (c == ')')
+				break;
+			continue;
+		}
+		if (isspace(c) || c == P_PAD) {
+			if (a.len == 0 || a.p[a.len - 1] == ' ')
+				continue;
+			if (c != P_PAD)
+				c = ' ';
+		}
+		bputc(&a, c);
+	}
+	free(a.p);
+	if (m->nparam == 0 && n == 1 && *args[0] == 0) {
+		free(args[0]);
+		n = 0;
+	}
+	/* f(x, ...) can be called as f(a) */
+	if (m->variadic && n == max - 1)
+		args[n++] = xstrdup("", 0);
+	if (n != m->nparam) {
+		pp_error(msg(m->name, ": wrong number of macro arguments"));
+		free_args(args, n < max ? n : max);
+		return NULL;
+	}
+	*np = n;
+	return args;
+}
+
+static void substitute(struct macro *m, char **args, struct buf *b)
+{
+	unsigned char *p = (unsigned char *)m->body;
+	char **exp = NULL;
+	char *s;
+	unsigned paste = 0;
+	unsigned n;
+	int c;
+
+	if (m->nparam > 0) {
+		exp = xrealloc(NULL, sizeof(char *) * m->nparam);
+		memset(exp, 0, sizeof(char *) * m->nparam);
+	}
+	while ((c = *p++) != 0) {
+		if (c == P_PASTE) {
+			paste = 1;
+			/* The GNU , ## __VA_ARGS__ loses the comma when there are
+			   no variable arguments and is just a comma otherwise */
+			if (m->variadic && *p == P_ARG && p[1] == m->nparam &&
+					b->len && b->p[b->len - 1] == ',') {
+				if (*args[m->nparam - 1] == 0)
+					b->len--;
+				paste = 0;
+			}
+			continue;
+		}
+		if (c == P_ARG) {
+			n = *p++ - 1;
+			/* Operands of ## are not expanded first, and make a new
+			   token that is free to be expanded */
+			if (paste || *p == P_PASTE) {
+				for (s = args[n]; *s; s++)
+					if (*s != P_NOEXP)
+						bputc(b, *s == P_PAD ? ' ' : *s);
+			} else {
+				if (exp[n] == NULL)
+					exp[n] = expand_text(args[n]);
+				bputs(b, exp[n], strlen(exp[n]));
+			}
+		} else if (c == P_STR)
+			stringize(b, args[*p++ - 1]);
+		else
+			bputc(b, c);
+		paste = 0;
+	}
+	if (exp)
+		free_args(exp, m->nparam);
+}
+
+/* Expand a macro whose name we have just read */
+static void expand(struct macro *m)
+{
+	struct buf b;
+	char **args = NULL;
+	unsigned nargs = 0;
+	unsigned nl = 0, sp = 0, pad = 0;
+	int c;
+
+	if (m->special == M_FILE) {
+		outname(cur->name);
+		return;
+	}
+	if (m->special == M_LINE) {
+		outnum(curline);
+		return;
+	}
+	if (m->nparam >= 0) {
+		while ((c = peekc(line_mode)) != 0 && (isspace(c) || c == P_PAD)) {
+			if (c == '\n')
+				nl = 1;
+			if (c == P_PAD)
+				pad = 1;
+			else
+				sp = 1;
+			in->ptr++;
+		}
+		if (c != '(') {
+			/* Just the name, not a call */
+			outs(m->name, strlen(m->name));
+			if (sp)
+				outc(nl ? '\n' : ' ');
+			else if (pad)
+				outc(P_PAD);
+			return;
+		}
+		in->ptr++;
+		args = collect_args(m, &nargs);
+		if (args == NULL)
+			return;
+	}
+	memset(&b, 0, sizeof(b));
+	/* Pad either side so nothing gets glued to the tokens around */
+	bputc(&b, P_PAD);
+	substitute(m, args, &b);
+	bputc(&b, P_PAD);
+	if (args)
+		free_args(args, nargs);
+	push_input(bterm(&b), m);
+}
+
+/* Copy input to output expanding macros as we go, until we run out */
+static void scan(void)
+{
+	struct macro *m;
+	int c, q;
+
+	while ((c = getc_in(0)) != 0) {
+		if (isdigit(c) || (c == '.' && isdigit(peekc(0)))) {
+			q = 0;
+			while (1) {
+				outc(c);
+				q = c;
+				c = peekc(0);
+				if (!isident(c) && c != '.' && !((c == '+' || c == '-') &&
+						(q == 'e' || q == 'E' || q == 'p' || q == 'P')))
+					break;
+				in->ptr++;
+			}
+		} else if (c == '"' || c == '\'') {
+			outc(c);
+			q = c;
+			while ((c = getc_in(0)) != 0) {
+				outc(c);
+				if (c == '\\') {
+					if ((c = getc_in(0)) == 0)
+						break;
+					outc(c);
+				} else if (c == q || c == '\n')
+					break;
+			}
+		} else if (isidstart(c) || (c == P_NOEXP && isidstart(peekc(0)))) {
+			q = c == P_NOEXP;
+			if (q)
+				c = getc_in(0);
+			name.len = 0;
+			bputc(&name, c);
+			while (isident(peekc(0)))
+				bputc(&name, *in->ptr++);
+			m = lookup(name.p, name.len);
+			if (m && !m->busy && !q)
+				expand(m);
+			else {
+				/* Once passed over it stays unexpanded for good */
+				if (m && (q || m->busy))
+					outc(P_NOEXP);
+				outs(name.p, name.len);
+			}
+		} else
+			outc(c);
+	}
+}
+
+/*
+ *	#if expressions
+ */
+
+static char *ep;
+static unsigned eval_bad;
+
+struct binop {
+	const char *op;
+	unsigned prec;
+};
+
+/* Two character operators come before any they start with */
+static const struct binop binops[] = {
+	{ "||", 1 }, { "&&", 2 }, { "==", 6 }, { "!=", 6 }, { "<=", 7 },
+	{ ">=", 7 }, { "<<", 8 }, { ">>", 8 }, { "|", 3 }, { "^", 4 },
+	{ "&", 5 }, { "<", 7 }, { ">", 7 }, { "+", 9 }, { "-", 9 },
+	{ "*", 10 }, { "/", 10 }, { "%", 10 }, { NULL, 0 }
+};
+
+/* Values carry their signedness so the usual conversions can be done */
+struct value {
+	long v;
+	unsigned u;
+};
+
+static unsigned eval_skip;	/* Inside an operand that isn't evaluated */
+
+static struct value cond(void);
+
+static long charconst(void)
+{
+	long v = 0;
+	unsigned n;
+	int c;
+
+	ep++;
+	while ((c = *ep) != 0 && c != '\'') {
+		ep++;
+		if (c == '\\') {
+			c = *ep++;
+			switch (c) {
+			case 'n':
+				c = '\n';
+				break;
+			case 't':
+				c = '\t';
+				break;
+			case 'r':
+				c = '\r';
+				break;
+			case 'a':
+				c = 7;
+				break;
+			case 'b':
+				c = '\b';
+				break;
+			case 'f':
+				c = '\f';
+				break;
+			case 'v':
+				c = '\v';
+				break;
+			case 'x':
+				c = 0;
+				while (isxdigit((unsigned char)*ep)) {
+					n = *ep++;
+					c = 16 * c + (isdigit(n) ? n - '0' : (n | 0x20) - 'a' + 10);
+				}
+				break;
+			default:
+				if (c >= '0' && c <= '7') {
+					c -= '0';
+					for (n = 0; n < 2 && *ep >= '0' && *ep <= '7'; n++)
+						c = 8 * c + *ep++ - '0';
+				}
+			}
+		}
+		v = (v << 8) | (c & 0xFF);
+	}
+	if (*ep == '\'')
+		ep++;
+	else
+		eval_bad = 1;
+	return v;
+}
+
+static struct value unary(void)
+{
+	struct value v;
+	unsigned long n;
+	char *s;
+
+	ep = skipws(ep);
+	switch (*ep) {
+	case '-':
+		ep++;
+		v = unary();
+		v.v = 0UL - (unsigned long)v.v;
+		return v;
+	case '+':
+		ep++;
+		return unary();
+	case '!':
+		ep++;
+		v = unary();
+		v.v = !v.v;
+		v.u = 0;
+		return v;
+	case '~':
+		ep++;
+		v = unary();
+		v.v = ~v.v;
+		return v;
+	case '(':
+		ep++;
+		v = cond();
+		ep = skipws(ep);
+		if (*ep == ')')
+			ep++;
+		else
+			eval_bad = 1;
+		return v;
+	case '\'':
+		v.v = charconst();
+		v.u = 0;
+		return v;
+	}
+	v.v = 0;
+	v.u = 0;
+	if (isdigit((unsigned char)*ep)) {
+		n = strtoul(ep, &s, 0);
+		ep = s;
+		/* A u suffix, or too big to be signed, makes it unsigned */
+		v.u = n > LONG_MAX;
+		while (isident((unsigned char)*ep)) {
+			if (*ep == 'u' || *ep == 'U')
+				v.u = 1;
+			ep++;
+		}
+		v.v = n;
+		return v;
+	}
+	/* Anything still a name by now is 0 */
+	if (isidstart((unsigned char)*ep)) {
+		ep += identlen(ep);
+		return v;
+	}
+	eval_bad = 1;
+	return v;
+}
+
+#define LONG_BITS	(8 * sizeof(long))
+
+static struct value binary(unsigned prec)
+{
+	const struct binop *o;
+	struct value v = unary();
+	struct value r;
+	unsigned long a, b;
+	unsigned skip;
+	unsigned u;
+
+	while (1) {
+		ep = skipws(ep);
+		for (o = binops; o->op; o++)
+			if (strncmp(ep, o->op, strlen(o->op)) == 0)
+				break;
+		if (o->op == NULL || o->prec < prec)
+			return v;
+		ep += strlen(o->op);
+		/* The right of && and || may not be evaluated at all */
+		skip = (o->prec == 1 && v.v) || (o->prec == 2 && !v.v);
+		eval_skip += skip;
+		r = binary(o->prec + 1);
+		eval_skip -= skip;
+		a = v.v;
+		b = r.v;
+		/* The usual conversions, but shifts keep the type of the left */
+		u = v.u || r.u;
+		switch (*o->op) {
+		case '|':
+			if (o->op[1]) {
+				v.v = v.v || r.v;
+				u = 0;
+			} else
+				v.v = a | b;
+			break;
+		case '&':
+			if (o->op[1]) {
+				v.v = v.v && r.v;
+				u = 0;
+			} else
+				v.v = a & b;
+			break;
+		case '^':
+			v.v = a ^ b;
+			break;
+		case '=':
+			v.v = a == b;
+			u = 0;
+			break;
+		case '!':
+			v.v = a != b;
+			u = 0;
+			break;
+		case '<':
+			if (o->op[1] == '<') {
+				v.v = b >= LONG_BITS ? 0 : a << b;
+				u = v.u;
+			} else {
+				if (u)
+					v.v = o->op[1] ? a <= b : a < b;
+				else
+					v.v = o->op[1] ? v.v <= r.v : v.v < r.v;
+				u = 0;
+			}
+			break;
+		case '>':
+			if (o->op[1] == '>') {
+				if (b >= LONG_BITS)
+					v.v = v.u || v.v >= 0 ? 0 : -1;
+				else
+					v.v = v.u ? (long)(a >> b) : v.v >> b;
+				u = v.u;
+			} else {
+				if (u)
+					v.v = o->op[1] ? a >= b : a > b;
+				else
+					v.v = o->op[1] ? v.v >= r.v : v.v > r.v;
+				u = 0;
+			}
+			break;
+		case '+':
+			v.v = a + b;
+			break;
+		case '-':
+			v.v = a - b;
+			break;
+		case '*':
+			v.v = a * b;
+			break;
+		case '/':
+		case '%':
+			if (b == 0) {
+				if (!eval_skip)
+					pp_error("division by zero in #if");
+				v.v = 0;
+			} else if (u)
+				v.v = *o->op == '/' ? a / b : a % b;
+			else if (r.v == -1)
+				/* LONG_MIN / -1 would trap */
+				v.v = *o->op == '/' ? (long)(0UL - a) : 0;
+			else
+				v.v = *o->op == '/' ? v.v / r.v : v.v % r.v;
+			break;
+		}
+		v.u = u;
+	}
+}
+
+static struct value cond(void)
+{
+	struct value v = binary(1);
+	struct value a, b;
+
+	ep = skipws(ep);
+	if (*ep != '?')
+		return v;
+	ep++;
+	eval_skip += !v.v;
+	a = cond();
+	eval_skip -= !v.v;
+	ep = skipws(ep);
+	if (*ep == ':')
+		ep++;
+	else
+		eval_bad = 1;
+	eval_skip += !!v.v;
+	b = cond();
+	eval_skip -= !!v.v;
+	/* The result has the type both sides convert to */
+	a.u |= b.u;
+	if (v.v)
+		return a;
+	b.u = a.u;
+	return b;
+}
+
+static long eval(char *p)
+{
+	struct buf b;
+	char *e, *q;
+	unsigned len, paren;
+	long v;
+
+	/* defined X is done first as X must not be expanded */
+	memset(&b, 0, sizeof(b));
+	while (*p) {
+		len = identlen(p);
+		if (isword(p, len, "defined")) {
+			q = skipws(p + len);
+			paren = *q == '(';
+			if (paren)
+				q = skipws(q + 1);
+			len = identlen(q);
+			if (len == 0) {
+				pp_error("bad use of defined");
+				break;
+			}
+			bputc(&b, lookup(q, len) ? '1' : '0');
+			q = skipws(q + len);
+			if (paren) {
+				if (*q == ')')
+					q++;
+				else
+					pp_error("bad use of defined");
+			}
+			p = q;
+		} else if (len) {
+			bputs(&b, p, len);
+			p += len;
+		} else if (isdigit((unsigned char)*p))
+			p = copy_number(&b, p);
+		else if (*p == '\'' || *p == '"')
+			p = copy_quoted(&b, p);
+		else
+			bputc(&b, *p++);
+	}
+	e = expand_line(bterm(&b));
+	free(b.p);
+	ep = e;
+	eval_bad = 0;
+	eval_skip = 0;
+	v = cond().v;
+	if (eval_bad || *skipws(ep))
+		pp_error("bad #if expression");
+	free(e);
+	return v;
+}
+
+/*
+ *	Files
+ */
+
+static void push_file(const char *path, int fd, unsigned dir)
+{
+	struct file *f = xrealloc(NULL, sizeof(struct file));
+	unsigned size = 0;
+	unsigned len = 0;
+	char *b = NULL;
+	int n;
+
+	do {
+		if (len == size) {
+			size = size ? 2 * size : 4096;
+			b = xrealloc(b, size);
+		}
+		n = read(fd, b + len, size - len);
+		if (n < 0)
+			pp_fatal(msg(path, ": read error"));
+		len += n;
+	} while (n);
+	close(fd);
+	f->prev = cur;
+	f->path = xstrdup(path, strlen(path));
+	f->name = f->path;
+	f->buf = b;
+	f->ptr = b;
+	f->end = b + len;
+	f->line = 1;
+	f->dir = dir;
+	f->ifbase = ifdepth;
+	f->guard = NULL;
+	f->gstate = G_START;
+	cur = f;
+	depth++;
+}
+
+static void add_skip(const char *path, const char *guard)
+{
+	struct skip *s = xrealloc(NULL, sizeof(struct skip) + strlen(path));
+	strcpy(s->path, path);
+	s->guard = guard ? xstrdup(guard, strlen(guard)) : NULL;
+	s->next = skiplist;
+	skiplist = s;
+}
+
+static void pop_file(void)
+{
+	struct file *f = cur;
+
+	if (ifdepth > f->ifbase) {
+		curline = f->line;
+		pp_error("unterminated #if");
+		ifdepth = f->ifbase;
+	}
+	if (f->gstate == G_END)
+		add_skip(f->path, f->guard);
+	cur = f->prev;
+	depth--;
+	if (f->name != f->path)
+		free(f->name);
+	free(f->path);
+	free(f->guard);
+	free(f->buf);
+	free(f);
+}
+
+/* Read the next logical line with continuations joined and comments
+   turned into spaces. Returns 0 at the end of the file */
+static unsigned read_line(void)
+{
+	char *p = cur->ptr;
+	char *e = cur->end;
+	int c;
+	int q = 0;
+
+	if (p == e)
+		return 0;
+	lbuf.len = 0;
+	curline = cur->line;
+	while (p < e) {
+		c = *p++;
+		if (c == '\\' && p < e && (*p == '\n' ||
+				(*p == '\r' && p + 1 < e && p[1] == '\n'))) {
+			p += *p == '\r' ? 2 : 1;
+			cur->line++;
+			continue;
+		}
+		if (c == '\r' && p < e && *p == '\n')
+			continue;
+		if (c == '\n') {
+			cur->line++;
+			break;
+		}
+		if (q) {
+			if (c == '\\' && p < e && *p != '\n') {
+				bputc(&lbuf, c);
+				c = *p++;
+			} else if (c == q)
+				q = 0;
+		} else if (c == '"' || c == '\'')
+			q = c;
+		else if (c == '/' && p < e && *p == '*') {
+			p++;
+			while (p < e && !(*p == '*' && p + 1 < e && p[1] == '/')) {
+				if (*p == '\n')
+					cur->line++;
+				p++;
+			}
+			if (p == e)
+				pp_error("unterminated comment");
+			else
+				p += 2;
+			c = ' ';
+		} else if (c == '/' && p < e && *p == '/') {
+			while (p < e && *p != '\n') {
+				if (*p == '\\' && p + 1 < e && p[1] == '\n') {
+					cur->line++;
+					p++;
+				}
+				p++;
+			}
+			continue;
+		}
+		bputc(&lbuf, c);
+	}
+	bputc(&lbuf, '\n');
+	bterm(&lbuf);
+	cur->ptr = p;
+	return 1;
+}
+
+static int try_open(const char *dir, unsigned dlen, const char *file)
+{
+	pathbuf.len = 0;
+	if (dlen) {
+		bputs(&pathbuf, dir, dlen);
+		bputc(&pathbuf, '/');
+	}
+	bputs(&pathbuf, file, strlen(file));
+	return open(bterm(&pathbuf), O_RDONLY);
+}
+
+/* #include_next carries on the search after the directory we came from */
+static void do_include(char *p, unsigned next)
+{
+	struct skip *s;
+	char *e = NULL;
+	char *f;
+	unsigned i;
+	int fd = -1;
+	int term;
+
+	p = skipws(p);
+	if (*p != '"' && *p != '<')
+		p = e = expand_line(p);
+	p = skipws(p);
+	term = *p == '<' ? '>' : '"';
+	if ((*p != '"' && *p != '<') || (f = strchr(p + 1, term)) == NULL) {
+		pp_error("bad #include");
+		free(e);
+		return;
+	}
+	*f = 0;
+	f = p + 1;
+	if (depth == MAXINCLUDE)
+		pp_fatal("includes nested too deeply");
+	/* "" looks next to the file doing the including first */
+	i = next ? cur->dir : 0;
+	if (*f == '/')
+		fd = try_open(NULL, 0, f);
+	else {
+		if (term == '"' && !next) {
+			p = strrchr(cur->path, '/');
+			fd = try_open(cur->path, p ? p - cur->path : 0, f);
+		}
+		for (; fd == -1 && i < nincdir; i++)
+			fd = try_open(incdir[i], strlen(incdir[i]), f);
+	}
+	if (fd == -1)
+		pp_fatal(msg(f, ": not found"));
+	free(e);
+	for (s = skiplist; s; s = s->next) {
+		if (strcmp(s->path, pathbuf.p) == 0 &&
+			(s->guard == NULL || lookup(s->guard, strlen(s->guard)))) {
+			close(fd);
+			return;
+		}
+	}
+	push_file(pathbuf.p, fd, i);
+}
+
+/* #line n "file" and the # n "file" form cpp itself writes */
+static void do_line(char *p)
+{
+	char *e = expand_line(p);
+	char *f;
+
+	p = skipws(e);
+	if (!isdigit((unsigned char)*p)) {
+		pp_error("bad #line");
+		free(e);
+		return;
+	}
+	cur->line = strtoul(p, &p, 10);
+	p = skipws(p);
+	if (*p == '"' && (f = strchr(p + 1, '"')) != NULL) {
+		if (cur->name != cur->path)
+			free(cur->name);
+		cur->name = xstrdup(p + 1, f - p - 1);
+	}
+	/* Make sure the tokenizer hears about it */
+	ofile = NULL;
+	free(e);
+}
+
+/* If this is #if !defined(X) return X */
+static char *not_defined(char *p, unsigned *len)
+{
+	char *n;
+	unsigned paren;
+	unsigned l;
+
+	if (*p != '!')
+		return NULL;
+	p = skipws(p + 1);
+	l = identlen(p);
+	if (!isword(p, l, "defined"))
+		return NULL;
+	p = skipws(p + l);
+	paren = *p == '(';
+	if (paren)
+		p = skipws(p + 1);
+	n = p;
+	*len = l = identlen(p);
+	if (l == 0)
+		return NULL;
+	p = skipws(p + l);
+	if (paren && *p++ != ')')
+		return NULL;
+	return *skipws(p) ? NULL : n;
+}
+
+static unsigned skipping(void)
+{
+	return ifdepth && (ifstack[ifdepth - 1] & 3) != IF_TRUE;
+}
+
+static void push_if(unsigned state)
+{
+	if (ifdepth == MAXIF)
+		pp_fatal("conditionals nested too deeply");
+	ifstack[ifdepth++] = skipping() ? IF_DONE : state;
+}
+
+static void directive(char *p)
+{
+	unsigned g = cur->gstate;
+	unsigned char *s;
+	unsigned len, n;
+	char *q;
+	long v;
+
+	/* Any directive but the guard's own ends a guarded header */
+	if (g != G_IN)
+		cur->gstate = G_NONE;
+	p = skipws(p);
+	if (*p == 0)
+		return;
+	if (isdigit((unsigned char)*p)) {
+		if (!skipping())
+			do_line(p);
+		return;
+	}
+	len = identlen(p);
+	q = skipws(p + len);
+
+	if (isword(p, len, "ifdef") || isword(p, len, "ifndef")) {
+		if (skipping()) {
+			push_if(IF_DONE);
+			return;
+		}
+		n = identlen(q);
+		if (n == 0)
+			pp_error("bad #ifdef");
+		v = lookup(q, n) != NULL;
+		if (len == 6) {
+			v = !v;
+			if (g == G_START && ifdepth == cur->ifbase && n) {
+				cur->guard = xstrdup(q, n);
+				cur->gstate = G_IN;
+			}
+		}
+		push_if(v ? IF_TRUE : IF_FALSE);
+		return;
+	}
+	if (isword(p, len, "if")) {
+		if (skipping()) {
+			push_if(IF_DONE);
+			return;
+		}
+		if (g == G_START && ifdepth == cur->ifbase &&
+				(p = not_defined(q, &n)) != NULL) {
+			cur->guard = xstrdup(p, n);
+			cur->gstate = G_IN;
+		}
+		push_if(eval(q) ? IF_TRUE : IF_FALSE);
+		return;
+	}
+	if (isword(p, len, "elif") || isword(p, len, "else")) {
+		if (ifdepth == cur->ifbase) {
+			pp_error(len == 4 && p[2] == 'i' ? "#elif without #if" : "#else without #if");
+			return;
+		}
+		if (g == G_IN && ifdepth == cur->ifbase + 1)
+			cur->gstate = G_NONE;
+		s = &ifstack[ifdepth - 1];
+		if (*s & IF_ELSE)
+			pp_error("#else after #else");
+		if ((*s & 3) == IF_TRUE)
+			*s = IF_DONE;
+		else if ((*s & 3) == IF_FALSE && (p[2] == 's' || eval(q)))
+			*s = IF_TRUE;
+		if (p[2] == 's')
+			*s |= IF_ELSE;
+		return;
+	}
+	if (isword(p, len, "endif")) {
+		if (ifdepth == cur->ifbase) {
+			pp_error("#endif without #if");
+			return;
+		}
+		ifdepth--;
+		if (g == G_IN && ifdepth == cur->ifbase)
+			cur->gstate = G_END;
+		return;
+	}
+	if (skipping())
+		return;
+	if (isword(p, len, "define"))
+		do_define(q);
+	else if (isword(p, len, "undef"))
+		undefine(q, identlen(q));
+	else if (isword(p, len, "include"))
+		do_include(q, 0);
+	else if (isword(p, len, "include_next"))
+		do_include(q, 1);
+	else if (isword(p, len, "line"))
+		do_line(q);
+	else if (isword(p, len, "error"))
+		pp_error(msg("#error ", q));
+	else if (isword(p, len, "warning"))
+		warning_at(cur->name, curline, msg("#warning ", q));
+	else if (isword(p, len, "pragma")) {
+		if (isword(q, identlen(q), "once"))
+			add_skip(cur->path, NULL);
+	} else if (!isword(p, len, "ident"))
+		pp_error("unknown directive");
+}
+
+/* Tell the tokenizer where the text that follows came from */
+static void sync_line(void)
+{
+	if (ofile == cur && curline >= oline && curline - oline < 8) {
+		while (oline < curline) {
+			outc('\n');
+			oline++;
+		}
+		return;
+	}
+	outs("# ", 2);
+	outnum(curline);
+	outc(' ');
+	outname(cur->name);
+	outc('\n');
+	ofile = cur;
+	oline = curline;
+}
+
+/* Produce the text for the next line that has any */
+static unsigned next_line(void)
+{
+	char *p;
+	unsigned start;
+
+	while (cur) {
+		if (!pending && !read_line()) {
+			pop_file();
+			continue;
+		}
+		pending = 0;
+		p = skipws(lbuf.p);
+		if (*p == '#') {
+			lbuf.p[lbuf.len - 1] = 0;
+			directive(p + 1);
+			continue;
+		}
+		if (skipping() || *p == '\n')
+			continue;
+		if (cur->gstate != G_IN)
+			cur->gstate = G_NONE;
+		sync_line();
+		start = obuf.len;
+		push_input(lbuf.p, NULL);
+		in->text = NULL;
+		line_mode = 1;
+		scan();
+		line_mode = 0;
+		pop_input();
+		if (obuf.p[obuf.len - 1] != '\n')
+			outc('\n');
+		while (start < obuf.len)
+			if (obuf.p[start++] == '\n')
+				oline++;
+		return 1;
+	}
+	return 0;
+}
+
+unsigned pp_read(unsigned char *buf, unsigned len)
+{
+	unsigned n;
+
+	while (opos == obuf.len) {
+		opos = obuf.len = 0;
+		if (!next_line())
+			return 0;
+	}
+	n = obuf.len - opos;
+	if (n > len)
+		n = len;
+	memcpy(buf, obuf.p + opos, n);
+	opos += n;
+	return n;
+}
+
+void pp_include_dir(const char *dir)
+{
+	if (nincdir == MAXINCLUDE)
+		pp_fatal("too many include directories");
+	incdir[nincdir++] = (char *)dir;
+}
+
+/* -Dname or -Dname=value */
+void pp_define(const char *def)
+{
+	struct buf b;
+	const char *p = strchr(def, '=');
+
+	memset(&b, 0, sizeof(b));
+	if (p) {
+		bputs(&b, def, p - def);
+		bputc(&b, ' ');
+		bputs(&b, p + 1, strlen(p + 1));
+	} else {
+		bputs(&b, def, strlen(def));
+		bputs(&b, " 1", 2);
+	}
+	do_define(bterm(&b));
+	free(b.p);
+}
+
+void pp_undef(const char *name)
+{
+	undefine(name, strlen(name));
+}
+
+static void builtin(const char *s, const char *body, unsigned special)
+{
+	struct macro *m;
+	unsigned len = strlen(s);
+
+	if (lookup(s, len))
+		return;
+	m = new_macro(s, len, xstrdup(body, strlen(body)), -1);
+	m->special = special;
+}
+
+void pp_open(const char *path)
+{
+	char date[14], tm[11];
+	time_t t = time(NULL);
+	char *p = ctime(&t);
+	int fd;
+
+	/* "Mmm dd yyyy" and "hh:mm:ss" */
+	date[0] = '"';
+	memcpy(date + 1, p + 4, 7);
+	memcpy(date + 8, p + 20, 4);
+	strcpy(date + 12, "\"");
+	tm[0] = '"';
+	memcpy(tm + 1, p + 11, 8);
+	strcpy(tm + 9, "\"");
+	builtin("__STDC__", "1", 0);
+	builtin("__STDC_VERSION__", "201710L", 0);
+	builtin("__STDC_HOSTED__", "1", 0);
+	builtin("__DATE__", date, 0);
+	builtin("__TIME__", tm, 0);
+	builtin("__FILE__", "", M_FILE);
+	builtin("__LINE__", "", M_LINE);
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		pp_fatal(msg(path, ": cannot open"));
+	push_file(path, fd, 0);
+}
@@ -0,0 +1,13 @@
+/*
+ *	Integrated preprocessor for cc0
+ */
+
+extern void pp_include_dir(const char *dir);
+extern void pp_define(const char *def);
+extern void pp_undef(const char *name);
+extern void pp_open(const char *path);
+extern unsigned pp_read(unsigned char *buf, unsigned len);
+
+/* Provided by the tokenizer */
+extern void error_at(const char *name, unsigned line, const char *p);
+extern void warning_at(const char *name, unsigned line, const char *p);
@@ -26,13 +26,13 @@ struct node *constant_node(void)
 		/* We have a temporary name */
 		n = make_label(label);
 		if (in_sizeof) {
-			unsigned *idx = idx_get(2);
-			*idx = 1;	/* 1 dimension */
+			unsigned idx[2];
+			idx[0] = 1;	/* 1 dimension */
 			idx[1] = len;
 #ifdef TARGET_CHAR_UNSIGNED
-			n->type = make_array(UCHAR, idx);
+			n->type = make_array(UCHAR, idx_find(idx));
 #else
-			n->type = make_array(CHAR, idx);
+			n->type = make_array(CHAR, idx_find(idx));
 #endif
 		} else {
 			/* The only case the array is seen as a sized array
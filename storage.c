@@ -42,7 +42,7 @@ void put_typed_data(struct node *n)
 	if (op != T_CASELABEL && op != T_PAD && op != T_LABEL &&
 		op != T_NAME && op != T_CONSTANT)
 		notconst();
-	out_block(n, sizeof(struct node));
+	write_node(n);
 }
 
 void put_padding_data(unsigned space)
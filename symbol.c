@@ -16,6 +16,16 @@ struct symbol symtab[MAXSYM];
 struct symbol *last_sym = symtab - 1;
 struct symbol *local_top = symtab;
 
+/* The index bits of infonext chain each named symbol onto a hash of its
+   name, and each free slot below last_sym onto the free list, in slot
+   order. Both hold the slot number plus one so that 0 ends the chain */
+#define NSYMHASH	64
+#define SYMHASH(n)	((n) & (NSYMHASH - 1))
+#define SET_INDEX(s, n)	((s)->infonext = ((s)->infonext & ~0x07FF) | (n))
+
+static unsigned symhash[NSYMHASH];
+static unsigned freelist;
+
 struct symbol *symbol_ref(unsigned type)
 {
 	return symtab + INFO(type);
@@ -25,50 +35,93 @@ struct symbol *symbol_ref(unsigned type)
 /* Find a symbol in the normal name space */
 struct symbol *find_symbol(unsigned name, unsigned global)
 {
-	struct symbol *s = last_sym;
+	struct symbol *s;
+	struct symbol *lmatch = NULL;
 	struct symbol *gmatch = NULL;
-	/* Walk backwards so that the first local we find is highest priority
-	   by scope */
-	while (s >= symtab) {
+	unsigned n = symhash[SYMHASH(name)];
+	/* The highest numbered local is the innermost by scope, and the
+	   lowest numbered global is the first declared */
+	while (n) {
+		s = symtab + n - 1;
 		if (s->name == name && s->infonext < S_TYPEDEF) {
 			if (s->infonext < S_STATIC) {
-				if (!global)
-					return s;
-			} else	/* Still need to look for a local */
+				if (!global && (lmatch == NULL || s > lmatch))
+					lmatch = s;
+			} else if (gmatch == NULL || s < gmatch)
 				gmatch = s;
 		}
-		s--;
+		n = S_INDEX(s->infonext);
 	}
+	if (lmatch)
+		return lmatch;
 	return gmatch;
 }
 
 struct symbol *find_symbol_by_class(unsigned name, unsigned class)
 {
-	struct symbol *s = last_sym;
+	struct symbol *s;
+	struct symbol *lmatch = NULL;
 	struct symbol *gmatch = NULL;
-	/* Walk backwards so that the first local we find is highest priority
-	   by scope */
-	while (s >= symtab) {
+	unsigned n = symhash[SYMHASH(name)];
+
+	while (n) {
+		s = symtab + n - 1;
 		if (s->name == name && S_STORAGE(s->infonext) == class) {
-			if (s->infonext < S_STATIC)
-				return s;
-			else	/* Still need to look for a local */
+			if (s->infonext < S_STATIC) {
+				if (lmatch == NULL || s > lmatch)
+					lmatch = s;
+			} else if (gmatch == NULL || s < gmatch)
 				gmatch = s;
 		}
-		s--;
+		n = S_INDEX(s->infonext);
 	}
+	if (lmatch)
+		return lmatch;
 	return gmatch;
 }
 
+static void unhash_symbol(struct symbol *s)
+{
+	unsigned *head = symhash + SYMHASH(s->name);
+	unsigned self = s - symtab + 1;
+	struct symbol *prev = NULL;
+	unsigned n = *head;
+
+	while (n != self) {
+		prev = symtab + n - 1;
+		n = S_INDEX(prev->infonext);
+	}
+	if (prev)
+		SET_INDEX(prev, S_INDEX(s->infonext));
+	else
+		*head = S_INDEX(s->infonext);
+}
+
 void pop_local_symbols(struct symbol *top)
 {
 	struct symbol *s = top + 1;
+	struct symbol *tail = NULL;
+	unsigned n = freelist;
+
+	/* Anything already free at or below the mark stays on the list */
+	while (n && symtab + n - 1 <= top) {
+		tail = symtab + n - 1;
+		n = S_INDEX(tail->infonext);
+	}
 	while (s <= last_sym) {
 		if (S_STORAGE(s->infonext) < S_STATIC) {
 			/* Write out any storage if needed */
 			symbol_bss(s);
+			if (S_STORAGE(s->infonext) != S_FREE)
+				unhash_symbol(s);
 			s->infonext = S_FREE;
 			s->name = 0;
+			/* Rebuild the rest of the free list in slot order */
+			if (tail)
+				SET_INDEX(tail, s - symtab + 1);
+			else
+				freelist = s - symtab + 1;
+			tail = s;
 		}
 		s++;
 	}
@@ -82,23 +135,33 @@ struct symbol *mark_local_symbols(void)
 
 /* The symbols from 0 to local_top are a mix of kinds but as we have not
    discarded below that point are all full. Between that and last_sym there
-   may be holes, above last_sym is free */
+   may be holes, which are kept on the free list lowest first, above
+   last_sym is free */
 struct symbol *alloc_symbol(unsigned name, unsigned local)
 {
-	struct symbol *s = local_top;
-	while (s <= &symtab[MAXSYM]) {
-		if (s->infonext == S_FREE) {
-			if (local && local_top < s)
-				local_top = s;
-			if (last_sym < s)
-				last_sym = s;
-			s->name = name;
-			s->data.idx = 0;
-			return s;
-		}
-		s++;
+	struct symbol *s;
+
+	if (freelist) {
+		s = symtab + freelist - 1;
+		freelist = S_INDEX(s->infonext);
+	} else {
+		s = last_sym + 1;
+		if (s == symtab + MAXSYM)
+			fatal("too many symbols");
+		last_sym = s;
+	}
+	if (local && local_top < s)
+		local_top = s;
+	s->name = name;
+	s->data.idx = 0;
+	/* Type slots are never looked up by name */
+	if (name == 0xFFFF)
+		s->infonext = S_FREE;
+	else {
+		s->infonext = symhash[SYMHASH(name)];
+		symhash[SYMHASH(name)] = s - symtab + 1;
 	}
-	fatal("too many symbols");
+	return s;
 }
 
 /*
@@ -148,7 +211,7 @@ struct symbol *update_symbol(struct symbol *sym, unsigned name, unsigned storage
 		sym = alloc_symbol(name, local);
 	/* Fill in the new or reserved symbol */
 	sym->type = type;
-	sym->infonext = storage;
+	sym->infonext = S_INDEX(sym->infonext) | storage;
 	sym->data.idx = 0;
 	return sym;
 }
@@ -187,40 +250,34 @@ struct symbol *update_symbol_by_name(unsigned name, unsigned storage,
  *	Find or insert a function prototype. We keep these in the sym table
  *	as a handy way to get an index for types.
  *
- *	Although it has a cost we really need to fold all the equivalently
- *	typed argument sets into a single instance to save memory.
- *
- *	TODO: we need to hash this, but differently to the usual symbol
- *	indexing as we care about the template pattern most
+ *	All the equivalently typed argument sets fold into a single instance
+ *	to save memory. The shape vectors are shared (see idx_find) so a slot
+ *	is identified by its kind, return or element type and vector pointer.
+ *	These slots are never looked up by name so their index bits chain them
+ *	on a hash of that instead.
  */
+static unsigned typehash[NSYMHASH];
+
 static struct symbol *do_type_match(unsigned st, unsigned rtype, unsigned *idx)
 {
-	struct symbol *sym = symtab;
-	while(sym <= last_sym) {
-		if (S_STORAGE(sym->infonext) == st && sym->type == rtype && sym->data.idx == idx) {
+	struct symbol *sym;
+	unsigned h = SYMHASH(rtype + *idx * 7 + idx[*idx]);
+	unsigned n = typehash[h];
+
+	while (n) {
+		sym = symtab + n - 1;
+		if (S_STORAGE(sym->infonext) == st && sym->type == rtype && sym->data.idx == idx)
 			return sym;
-		}
-		sym++;
+		n = S_INDEX(sym->infonext);
 	}
 	sym = alloc_symbol(0xFFFF, 0);
-	sym->infonext = st;
+	sym->infonext = st | typehash[h];
+	typehash[h] = sym - symtab + 1;
 	sym->data.idx = idx;
 	sym->type = rtype;
 	return sym;
 }
 
-unsigned *sym_find_idx(unsigned storage, unsigned *idx, unsigned len)
-{
-	struct symbol *sym = symtab;
-	unsigned blen = len * sizeof(unsigned);
-	while (sym <= last_sym) {
-		if (S_STORAGE(sym->infonext) == storage && memcmp(sym->data.idx, idx, blen) == 0)
-			return sym->data.idx;
-		sym++;
-	}
-	return idx_copy(idx, len);
-}
-
 unsigned func_return(unsigned n)
 {
 	if (!IS_FUNCTION(n))
@@ -245,7 +302,7 @@ unsigned make_function(unsigned type, unsigned *idx)
 unsigned func_symbol_type(unsigned type, unsigned *idx)
 {
 	struct symbol *sym;
-	idx = sym_find_idx(S_FUNCDEF, idx, *idx + 1);
+	idx = idx_find(idx);
 	sym = do_type_match(S_FUNCDEF, type, idx);
 	return C_FUNCTION | ((sym - symtab) << 3);
 }
@@ -286,11 +343,11 @@ unsigned array_with_size(unsigned t, unsigned size)
 	unsigned x[9];	/* Max ptr depth of 8  + size */
 	unsigned *idx;
 
-	memcpy(x, sym->data.idx, 9 * sizeof(unsigned));
+	memcpy(x, sym->data.idx, (*sym->data.idx + 1) * sizeof(unsigned));
 	x[1] = size;
 
 	/* See if this type exists */
-	idx = sym_find_idx(S_ARRAY, x, *x + 1);
+	idx = idx_find(x);
 	/* Make the new one, or find the reference */
 	return make_array(sym->type, idx);
 }
@@ -317,19 +374,23 @@ unsigned array_compatible(unsigned t1, unsigned t2)
 
 static struct symbol *find_struct(unsigned name)
 {
-	struct symbol *sym = symtab;
+	struct symbol *sym;
+	struct symbol *match = NULL;
+	unsigned n = symhash[SYMHASH(name)];
 	/* Anonymous structs are unique each time */
 	if (name == 0)
 		return 0;
-	while(sym <= last_sym) {
+	while (n) {
+		sym = symtab + n - 1;
 		if (sym->name == name) {
 			unsigned st = S_STORAGE(sym->infonext);
-			if (st == S_STRUCT || st == S_UNION)
-				return sym;
+			if ((st == S_STRUCT || st == S_UNION) &&
+				(match == NULL || sym < match))
+				match = sym;
 		}
-		sym++;
+		n = S_INDEX(sym->infonext);
 	}
-	return NULL;
+	return match;
 }
 
 struct symbol *update_struct(unsigned name, unsigned t)
@@ -342,7 +403,7 @@ struct symbol *update_struct(unsigned name, unsigned t)
 	sym = find_struct(name);
 	if (sym == NULL) {
 		sym = alloc_symbol(name, 0);	/* TODO scoping */
-		sym->infonext = t;
+		sym->infonext |= t;
 		sym->data.idx = NULL;	/* Not yet known */
 	} else {
 		if (S_STORAGE(sym->infonext) != t)
@@ -42,7 +42,6 @@ extern struct symbol *find_symbol_by_class(unsigned name, unsigned class);
 extern struct symbol *alloc_symbol(unsigned name, unsigned local);
 extern void pop_local_symbols(struct symbol *top);
 extern struct symbol *mark_local_symbols(void);
-extern unsigned *sym_find_idx(unsigned storage, unsigned *idx, unsigned len);
 extern unsigned func_return(unsigned type);
 extern unsigned *func_args(unsigned type);
 extern unsigned make_function(unsigned type, unsigned *id);
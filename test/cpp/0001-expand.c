@@ -0,0 +1,55 @@
+/*
+ *	Rescanning, painted names and padding, mostly from C99 6.10.3.5
+ */
+
+int f(int);
+int y, z[2], OBJ, FN(int);
+
+#define x	3
+#define f(a)	f(x * (a))
+#undef x
+#define x	2
+#define g	f
+#define z	z[0]
+#define h	g(~
+#define m(a)	a(w)
+#define w	0,1
+#define t(a)	a
+#define p()	int
+#define q(x)	x
+#define r(x,y)	x ## y
+#define str(x)	# x
+#define xstr(x)	str(x)
+#define hash_hash # ## #
+#define mkstr(a) # a
+#define in_between(a) mkstr(a)
+#define join(c, d) in_between(c hash_hash d)
+
+int test1(void)
+{
+	return f(y+1) + f(f(z)) % t(t(g)(0) + t)(1);
+}
+
+int test2(void)
+{
+	return g(x+(3,4)-w) | h 5) & m
+		(f)^m(m);
+}
+
+p() i[q()] = { q(1), r(2,3), r(4,), r(,5), r(,) };
+char c[2][6] = { str(hello), str() };
+
+#define ax	(4 + (2 * ax))
+#define ay	(2 * ax)
+#define both(a,b)	a + b
+#define cat(a,b)	a ## b
+char *j = join(x, y);
+char *k = xstr(both(ax, ay));
+char *l = xstr(cat(a, x) cat(a,y));
+
+#define OBJ	OBJ + 1
+#define FN(a)	FN(a) + OBJ
+int test4(void)
+{
+	return FN(OBJ) + FN(FN(1));
+}
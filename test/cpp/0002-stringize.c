@@ -0,0 +1,30 @@
+/*
+ *	# and ## on awkward spellings
+ */
+
+#define str(x)	# x
+#define xstr(x)	str(x)
+#define glue(a, b)	a ## b
+#define xglue(a, b)	glue(a, b)
+#define HIGHLOW	"hello"
+#define LOW	LOW ", world"
+#define EMPTY
+
+char *s1 = str("a\n");
+char *s2 = str('\'');
+char *s3 = str('"');
+char *s4 = str("\\" "\"");
+char *s5 = str(  a   +    b  );
+char *s6 = str( "x y"	'\t' );
+char *s7 = xstr(EMPTY a EMPTY b EMPTY);
+char *s8 = glue(HIGH, LOW);
+char *s9 = xglue(HIGH, LOW);
+char *s10 = str(strncmp("abc\0d", "abc", '\4') == 0);
+char *s11 = xstr(__LINE__);
+char s12[] = str(@\n);
+int s13 = glue(12, 34) + glue(0x, 1f);
+
+#define INCFILE(n)	vers ## n
+char *s14 = xstr(INCFILE(2).h);
+char *s15 = xstr(INCFILE(2) . h);
+char *s16 = xstr(( INCFILE(3) ));
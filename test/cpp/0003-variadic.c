@@ -0,0 +1,25 @@
+/*
+ *	Variadic macros and the GNU comma elision
+ */
+
+int f0(int, ...);
+
+#define V(...)		f0(0, ## __VA_ARGS__)
+#define W(fmt, ...)	f0(fmt, ##__VA_ARGS__)
+#define N(fmt, args...)	f0(fmt , ## args)
+#define S(...)		# __VA_ARGS__
+#define C(a, ...)	f0(a, __VA_ARGS__)
+#define ONE		1
+
+int test(void)
+{
+	f0(1, S(), S(a), S(a, b,c));
+	C(1, 2);
+	C(ONE, ONE, ONE);
+	N(1);
+	N(1, 2, 3);
+	W(ONE);
+	W(ONE, ONE);
+	V(ONE);
+	return V();
+}
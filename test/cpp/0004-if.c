@@ -0,0 +1,47 @@
+/*
+ *	Arithmetic in #if
+ */
+
+int ok;
+
+#if -1 < 0u
+#error unsigned compare
+#endif
+#if !(-1 < 0)
+#error signed compare
+#endif
+#if (-1 >> 1) != -1
+#error signed shift
+#endif
+#if (0u - 1) >> 1 < 0x7FFFFFFF
+#error unsigned shift
+#endif
+#if 0 && (1 / 0)
+#error short circuit
+#endif
+#if 1 || (1 % 0)
+#else
+#error short circuit
+#endif
+#if (1 ? 2 : (1 / 0)) != 2
+#error conditional
+#endif
+#if (1 ? -1 : 0u) < 0
+#error conditional type
+#endif
+#if 0xFFFFFFFFFFFFFFFF != -1
+#error large constant
+#endif
+#if (-7 / 2) != -3 || (-7 % 2) != -1 || 7u % 3 != 1
+#error divide
+#endif
+#if '\377' >= 0 && '\377' != 255
+#error char constant
+#endif
+#if __STDC__ != 1 || __STDC_HOSTED__ != 1 || __STDC_VERSION__ < 199901L
+#error predefined
+#endif
+#define ZERO 0
+#if defined(ZERO) && !defined UNDEF && (ZERO + UNDEF) == 0
+int passed;
+#endif
@@ -0,0 +1,14 @@
+#!/bin/sh
+# Compile each macro torture test with cpp and with the integrated
+# preprocessor, the code generated must be the same
+rc=0
+for i in cpp/*.c
+do
+	b=$(basename $i .c)
+	echo $b":"
+	fcc -S -mz80 cpp/$b.c && mv cpp/$b.s cpp/$b.ext.s &&
+	fcc -S -mz80 -fintegrated-cpp cpp/$b.c &&
+	cmp cpp/$b.ext.s cpp/$b.s || rc=1
+	rm -f cpp/$b.s cpp/$b.ext.s
+done
+exit $rc
@@ -1,9 +1,10 @@
 #!/bin/sh
+# Any arguments go to fcc, so -O2 tests the tree pass (cc1b) as well
 for i in tests/*.c
 do
 	b=$(basename $i .c)
 	echo  $b":"
-	fcc -m8085 -c tests/$b.c
+	fcc "$@" -m8085 -c tests/$b.c
 	ld8080 -b -C0 testcrt0.o tests/$b.o -o tests/$b /opt/fcc/lib/8080/lib8085.a -m tests/$b.map
 	./emu85 tests/$b tests/$b.map
 done
@@ -1,9 +1,10 @@
 #!/bin/sh
+# Any arguments go to fcc, so -O2 tests the tree pass (cc1b) as well
 for i in tests/*.c
 do
 	b=$(basename $i .c)
 	echo  $b":"
-	fcc -m6502 -c tests/$b.c
+	fcc "$@" -m6502 -c tests/$b.c
 	ld6502 -b -C512 testcrt0_6502.o tests/$b.o -o tests/$b /opt/fcc/lib/6502/lib6502.a -m tests/$b.map
 	./emu6502 tests/$b tests/$b.map
 done
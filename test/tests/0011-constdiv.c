@@ -0,0 +1,89 @@
+/*
+ *	Division by constants that some targets do with a multiply
+ */
+
+volatile unsigned char vc;
+volatile unsigned char *vp = &vc;
+
+unsigned char divc10(unsigned char a)
+{
+    return a / 10;
+}
+
+unsigned char modc7(unsigned char a)
+{
+    return a % 7;
+}
+
+unsigned divw3(unsigned char a)
+{
+    return (unsigned)a / 3;
+}
+
+int modw5(unsigned char a)
+{
+    int x = a;
+    return x % 5;
+}
+
+unsigned divu10(unsigned a)
+{
+    return a / 10;
+}
+
+unsigned modu7(unsigned a)
+{
+    return a % 7;
+}
+
+unsigned long divl10(unsigned long a)
+{
+    return a / 10;
+}
+
+unsigned char modv5(void)
+{
+    return *vp % 5;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned i;
+    unsigned char c;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        if (divc10(c) != i / 10U)
+            return 1;
+        if (modc7(c) != i % 7U)
+            return 2;
+        if (divw3(c) != i / 3U)
+            return 3;
+        if (modw5(c) != (int)(i % 5U))
+            return 4;
+    }
+    if (divu10(65535U) != 6553U || divu10(9) != 0)
+        return 5;
+    if (modu7(65535U) != 1 || modu7(700) != 0)
+        return 6;
+    if (divl10(4000000000UL) != 400000000UL)
+        return 7;
+    vc = 253;
+    if (modv5() != 3)
+        return 8;
+    c = 200;
+    c /= 7;
+    if (c != 28)
+        return 9;
+    c %= 5;
+    if (c != 3)
+        return 10;
+    vc = 99;
+    vc %= 10;
+    if (vc != 9)
+        return 11;
+    vc /= 3;
+    if (vc != 3)
+        return 12;
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ *	Code the -O2 tree pass (cc1b) rewrites: constants carried into
+ *	later expressions, dead stores, folding and common subexpressions.
+ */
+
+int calls;
+
+int side(int a)
+{
+    calls++;
+    return a;
+}
+
+/* Constants must stop at a join where a path may differ */
+int carry(int a)
+{
+    int x = 4;
+    int y;
+
+    y = x * 3;
+    if (a)
+        x = 7;
+    return x + y;
+}
+
+int loop(int n)
+{
+    int x = 1;
+    int i;
+
+    for (i = 0; i < n; i++)
+        x = x * 2;
+    return x;
+}
+
+/* The first store is dead, the call in the second must still happen */
+int dead(int a)
+{
+    int x;
+
+    x = 5;
+    x = a + 1;
+    x = side(a);
+    return a + 2;
+}
+
+/* A local whose address is taken is left alone */
+int escaped(void)
+{
+    int x = 3;
+    int *p = &x;
+
+    *p = 9;
+    return x;
+}
+
+unsigned char wrap(void)
+{
+    unsigned char c = 250;
+
+    c += 10;
+    return c;
+}
+
+/* a * b + 1 is worked out once, side() is called every time */
+int common(int a, int b)
+{
+    int r;
+
+    r = (a * b + 1) * (a * b + 1) + side(a) + side(a);
+    return r;
+}
+
+int fold(int a)
+{
+    if (2 * 3 == 6)
+        a += 1;
+    else
+        a += 100;
+    return (a * 1) + 0 - (a - a);
+}
+
+long longs(long a)
+{
+    long x = 0x12345L;
+
+    x <<= 4;
+    return a + x;
+}
+
+int branch(int a)
+{
+    int x;
+
+    switch (a) {
+    case 1:
+        x = 10;
+        break;
+    case 2:
+        x = 20;
+        goto out;
+    default:
+        x = 30;
+    }
+    x++;
+out:
+    return x;
+}
+
+int main(int argc, char *argv[])
+{
+    if (carry(0) != 16)
+        return 1;
+    if (carry(1) != 19)
+        return 2;
+    if (loop(0) != 1)
+        return 3;
+    if (loop(5) != 32)
+        return 4;
+    calls = 0;
+    if (dead(3) != 5 || calls != 1)
+        return 5;
+    if (escaped() != 9)
+        return 6;
+    if (wrap() != 4)
+        return 7;
+    calls = 0;
+    if (common(2, 3) != 53 || calls != 2)
+        return 8;
+    if (fold(4) != 5)
+        return 9;
+    if (longs(1) != 0x123451L)
+        return 10;
+    if (branch(1) != 11)
+        return 11;
+    if (branch(2) != 20)
+        return 12;
+    if (branch(5) != 31)
+        return 13;
+    return 0;
+}
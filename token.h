@@ -108,7 +108,7 @@
 #define T_RESTRICT	0x1020	/* We treat this as a nop */
 
 /* Encodings for tokenized constants */
-/* These are followed by a 4 byte little endian value */
+/* These are followed by their value (see TK_VALUE) */
 #define T_INTVAL	0x1100
 #define T_UINTVAL	0x1101
 #define T_LONGVAL	0x1102
@@ -144,3 +144,32 @@
 
 /* Used to pass line number information */
 #define T_LINE		0x3FFF
+
+/*
+ *	The token stream between cc0 and cc1 is compacted. It begins with
+ *	TK_MAGIC TK_VERSION and then each token is a code byte followed by
+ *	any data for it. Integer values are sent as a little endian base 128
+ *	varint (low 7 bits first, top bit set if more follows), float values
+ *	as 4 bytes little endian. Strings are as before. Any token without a
+ *	short form is sent as TK_FULL followed by the 16bit token.
+ */
+#define TK_MAGIC	0xFC
+#define TK_VERSION	1
+
+#define TK_EOF		0x00
+#define TK_UNI		0x01	/* Single byte tokens in TK_UNICHARS order */
+#define TK_UNICHARS	"()[]{}&*/%+-?:^<>|~!=;.,"
+#define TK_SPECIAL	0x19	/* T_SHLEQ to T_ELLIPSIS */
+#define TK_DOUBLESYM	0x1D	/* T_PLUSPLUS to T_ANDAND */
+#define TK_SYMEQ	0x24	/* T_PLUSEQ to T_GTEQ */
+#define TK_VALUE	0x2F	/* T_INTVAL to T_STRING_END */
+#define TK_KEYWORD	0x36	/* T_CHAR to T_RESTRICT */
+#define TK_FULL		0x57	/* 16bit token follows */
+#define TK_FILE		0x58	/* Line varint, file name, 0 */
+#define TK_LINE		0x59	/* Line delta varint, low bit is sign */
+#define TK_NEXTLINE	0x5A	/* Line moves on 1 to 6 */
+#define TK_SYMBOL	0x60	/* Symbols below TK_NSYM1 */
+#define TK_SYMBOL2	0xF0	/* Then bits 11-8 of the rest, then bits 7-0 */
+
+#define TK_NSYM1	(TK_SYMBOL2 - TK_SYMBOL)
+#define TK_NSYM2	(TK_NSYM1 + 0x1000)
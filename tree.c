@@ -9,15 +9,26 @@
 
 #include "compiler.h"
 
+#ifdef ARENA
+static struct arena node_arena = {
+	NULL, NULL, NULL, NULL, NUM_NODES * sizeof(struct node)
+};
+#else
 static struct node node_table[NUM_NODES];
+#endif
 static struct node *nodes;
 
 struct node *new_node(void)
 {
 	struct node *n;
 	if (nodes == NULL) {
+#ifdef ARENA
+		nodes = arena_alloc(&node_arena, sizeof(struct node));
+		nodes->right = NULL;
+#else
 		error("too complex");
 		exit(1);
+#endif
 	}
 	n = nodes;
 	nodes = n->right;
@@ -37,12 +48,44 @@ void free_node(struct node *n)
 
 void init_nodes(void)
 {
+#ifndef ARENA
 	int i;
 	struct node *n = node_table;
 	for (i = 0; i < NUM_NODES; i++)
 		free_node(n++);
+#endif
+}
+
+/* Nothing lives past the end of a function, so take back everything
+   including any nodes that were dropped rather than freed */
+void reset_nodes(void)
+{
+	nodes = NULL;
+#ifdef ARENA
+	arena_reset(&node_arena);
+#else
+	init_nodes();
+#endif
+}
+
+
+/*
+ *	IMPURE means something below this node has a side effect. It is kept
+ *	up to date as each node is built or has its children changed so that
+ *	folding never has to walk a subtree to find out.
+ */
+static unsigned impure(struct node *n)
+{
+	if (n && (n->flags & (SIDEEFFECT | IMPURE)))
+		return IMPURE;
+	return 0;
 }
 
+static void set_impure(struct node *n)
+{
+	n->flags &= ~IMPURE;
+	n->flags |= impure(n->left) | impure(n->right);
+}
 
 struct node *tree(unsigned op, struct node *l, struct node *r)
 {
@@ -61,6 +104,7 @@ struct node *tree(unsigned op, struct node *l, struct node *r)
 	n->left = l;
 	n->right = r;
 	n->op = op;
+	n->flags |= impure(l) | impure(r);
 	/* Inherit from left if present, right if not */
 	if (l)
 		n->type = l->type;
@@ -253,9 +297,16 @@ void free_tree(struct node *n)
 	free_node(n);
 }
 
+/* Pack a node without its children, see tree.h for the layout */
+void write_node(struct node *n)
+{
+	unsigned char buf[NODE_MAX];
+	out_block(buf, pack_node(n, buf));
+}
+
 static void write_subtree(struct node *n)
 {
-	out_block(n, sizeof(struct node));
+	write_node(n);
 	if (n->left)
 		write_subtree(n->left);
 	if (n->right)
@@ -302,7 +353,7 @@ struct node *bool_tree(struct node *n, unsigned flags)
 		b->op = T_BOOL;
 		b->type = CINT;
 		b->right = n;
-		b->flags |= flags;
+		b->flags |= flags | impure(n);
 		return b;
 	} else {
 		n = tree(T_BOOL, NULL, n);
@@ -482,24 +533,13 @@ static unsigned is_name(unsigned n)
 	return 0;
 }
 
-/* Check of the tree has side effects */
+/* Check if the tree has side effects */
 static unsigned tree_impure(struct node *n)
 {
-	if (n->right) {
-		if (tree_impure(n->right))
-			return 1;
-	}
-	if (n->left) {
-		if (tree_impure(n->left))
-			return 1;
-	}
-	return n->flags & SIDEEFFECT;
+	return n->flags & (SIDEEFFECT | IMPURE);
 }
 
 /*
- *	TODO:
- *	We need a sensible way of not rewalking the same trees
- *
  *	Walk down a tree and attempt to reduce it to the simplest
  *	form we can manage. At the moment we do this repeatedly as
  *	we build the tree but that needs rethinking. On the other hand
@@ -539,6 +579,7 @@ struct node *constify(struct node *n)
 			free_node(l->right);
 			free_node(l);
 			l = n->left;
+			set_impure(n);
 		}
 	}
 	/* Remove multiply by 1 or 0 */
@@ -617,6 +658,7 @@ struct node *constify(struct node *n)
 		if (r == NULL)
 			return NULL;
 		n->right = r;
+		set_impure(n);
 	}
 	if (l) {
 		unsigned lt = l->type;
@@ -654,6 +696,7 @@ struct node *constify(struct node *n)
 			if (l == NULL)
 				return NULL;
 			n->left = l;
+			set_impure(n);
 		}
 		/* Only do constant work with simple types */
 		if (!IS_INTORPTR(lt))
@@ -18,7 +18,25 @@ struct node
     unsigned val2;		/* Label for name, (also used for code gen) */
 };
 
+/*
+ *	Trees go to cc2 as a prefix walk of packed nodes, each a length byte
+ *	and then varints: op, flags shifted up over the N_ bits saying which
+ *	children and fields follow, type, then value (zigzagged), snum and
+ *	val2 where they are non zero. The stream starts %V and the version.
+ */
+#define TREE_VERSION	1
+
+#define N_LEFT		1
+#define N_RIGHT		2
+#define N_VALUE		4
+#define N_SNUM		8
+#define N_VAL2		16
+#define N_SHIFT		5
+
+#define NODE_MAX	64	/* Packed size limit including the length */
+
 extern void init_nodes(void);
+extern void reset_nodes(void);
 
 extern struct node *tree(unsigned op, struct node *l, struct node *r);
 extern struct node *sf_tree(unsigned op, struct node *l, struct node *r);
@@ -32,6 +50,9 @@ extern struct node *make_constant(unsigned long val, unsigned t);
 extern struct node *make_symbol(struct symbol *s);
 extern struct node *make_label(unsigned n);
 
+extern unsigned pack_node(struct node *n, unsigned char *buf);
+extern unsigned unpack_node(struct node *n, unsigned char *p);
+extern void write_node(struct node *n);
 extern void write_tree(struct node *n);
 extern void free_tree(struct node *n);
 extern void write_null_tree(void);
@@ -0,0 +1,98 @@
+/*
+ *	Packing of tree nodes for the stream between the passes, see tree.h
+ *	for the layout. cc1 writes it, cc1b reads and writes it and cc2 reads
+ *	it, so they all share this one copy.
+ */
+
+#include <stdio.h>
+
+#include "compiler.h"
+
+static unsigned char *put_varint(unsigned char *p, unsigned long v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static unsigned long get_varint(unsigned char **pp)
+{
+	unsigned char *p = *pp;
+	unsigned long v = 0;
+	unsigned shift = 0;
+
+	while (*p & 0x80) {
+		v |= (unsigned long)(*p++ & 0x7F) << shift;
+		shift += 7;
+	}
+	v |= (unsigned long)*p++ << shift;
+	*pp = p;
+	return v;
+}
+
+/* Pack a node without its children into buf, which must hold NODE_MAX
+   bytes. Returns the length including the length byte at the front */
+unsigned pack_node(struct node *n, unsigned char *buf)
+{
+	unsigned char *p = buf + 1;
+	unsigned shape = n->flags << N_SHIFT;
+	unsigned long v = n->value;
+
+	if (n->left)
+		shape |= N_LEFT;
+	if (n->right)
+		shape |= N_RIGHT;
+	if (v)
+		shape |= N_VALUE;
+	if (n->snum)
+		shape |= N_SNUM;
+	if (n->val2)
+		shape |= N_VAL2;
+	p = put_varint(p, n->op);
+	p = put_varint(p, shape);
+	p = put_varint(p, n->type);
+	if (v) {
+		/* Keep small negative numbers small whatever size long is */
+		if ((signed long)v < 0)
+			v = (~v << 1) | 1;
+		else
+			v <<= 1;
+		p = put_varint(p, v);
+	}
+	if (n->snum)
+		p = put_varint(p, n->snum);
+	if (n->val2)
+		p = put_varint(p, n->val2);
+	buf[0] = p - buf - 1;
+	return p - buf;
+}
+
+/* Unpack a node from p, just past its length byte. The children are left
+   for the caller, we return which of them follow */
+unsigned unpack_node(struct node *n, unsigned char *p)
+{
+	unsigned shape;
+	unsigned long v;
+
+	n->op = get_varint(&p);
+	shape = get_varint(&p);
+	n->flags = shape >> N_SHIFT;
+	n->type = get_varint(&p);
+	n->value = 0;
+	n->snum = 0;
+	n->val2 = 0;
+	if (shape & N_VALUE) {
+		v = get_varint(&p);
+		n->value = (v & 1) ? ~(v >> 1) : v >> 1;
+	}
+	if (shape & N_SNUM)
+		n->snum = get_varint(&p);
+	if (shape & N_VAL2)
+		n->val2 = get_varint(&p);
+	n->left = NULL;
+	n->right = NULL;
+	return shape & (N_LEFT | N_RIGHT);
+}
@@ -290,7 +290,7 @@ void type_parse_function(unsigned ptr)
 	header(H_ARGFRAME, arg_size(), 0);
 	pop_storage(&argsave, &locsave);
 
-	idx = sym_find_idx(S_FUNCDEF, tplt, *tplt + 1);
+	idx = idx_find(tplt);
 	declarator_add(T_LPAREN, ptr, idx);
 }
 
@@ -323,7 +323,7 @@ void type_parse_array(unsigned ptr)
 		dim[++ndim] = n;
 	}
 	dim[0] = ndim;
-	idx = sym_find_idx(S_ARRAY, dim, *dim + 1);
+	idx = idx_find(dim);
 	declarator_add(T_LSQUARE, ptr, idx);
 }
 